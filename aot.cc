@@ -0,0 +1,36 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "lc3.h"
+#include "lc3_loader.h"
+#include "lc3_aot.h"
+
+using std::string;
+
+// lc3_aot <image> [more images] <output.cc>, see lc3_aot.h
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        throw std::runtime_error("Not enough arguments provided (expected lc3_aot <image> [more images] <output.cc>)");
+    }
+
+    std::vector<string> images(argv + 1, argv + argc - 1);
+    string output_path = argv[argc - 1];
+
+    LC3_Machine *machine = new LC3_Machine();
+    image_load loaded = load_images(images, machine);
+    for (const string &warning : loaded.warnings) {
+        std::cerr << "warning: " << warning << std::endl;
+    }
+
+    string source = translate_program(machine, loaded.segments, images[0]);
+    delete machine;
+
+    std::ofstream out(output_path);
+    if (!out || !(out << source)) {
+        throw std::runtime_error("Couldn't write " + output_path);
+    }
+    return 0;
+}
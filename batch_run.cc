@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_loader.h"
+#include "lc3_memory.h"
+#include "lc3_pool.h"
+#include "lc3_sched.h"
+#include "lc3_snapshot.h"
+#include "lc3_headless.h"
+#include "batch_run.h"
+
+namespace {
+
+// how long -guests' typist waits when every guest is still busy with its last line
+const auto TYPING_PAUSE = std::chrono::microseconds(50);
+
+enum {
+    JOB_PASS,  // halted, output matched (or there was nothing to match)
+    JOB_FAIL,  // ran, but the output was wrong or it never halted
+    JOB_ERROR  // couldn't even start, missing files and such
+};
+
+struct job_result {
+    int status = JOB_ERROR;
+    std::string detail;
+    std::vector<std::string> warnings; // from the loader
+    double ms = 0;
+    uint64_t executed = 0;
+};
+
+// on failure contents is why, running out of descriptors looks different from a missing file
+bool read_file(const std::string &path, std::string &contents) {
+    errno = 0;
+    std::ifstream ifs{path, std::ios::binary};
+    if (!ifs) {
+        contents = errno ? std::strerror(errno) : "can't open";
+        return false;
+    }
+    std::ostringstream ss;
+    ss << ifs.rdbuf();
+    contents = ss.str();
+    return true;
+}
+
+std::string hex(uint16_t value) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "x%04X", value);
+    return buf;
+}
+
+// image lists that more than one job in the batch runs, loaded once and shared copy-on-write
+// (lc3_memory.h) by every machine that runs them. Each is loaded by the first job to get to it, and
+// dropped again once the last of its jobs has started, so only lists still to be run hold an image.
+// Lists only one job runs are loaded privately, sharing would just be extra work
+class Shared_Images {
+    struct shared_load {
+        std::shared_ptr<LC3_Image> image;
+        std::vector<std::string> warnings; // from the loader
+    };
+
+    struct entry {
+        std::shared_future<shared_load> load; // not valid until a job starts loading
+        size_t jobs_left;                     // jobs on these images that haven't started yet
+    };
+
+    std::mutex lock;
+    std::map<std::vector<std::string>, entry> entries;
+
+    public:
+        explicit Shared_Images(const std::vector<batch_job> &jobs) {
+            std::map<std::vector<std::string>, size_t> counts;
+            for (const batch_job &job : jobs) {
+                counts[job.images]++;
+            }
+            for (auto &[images, count] : counts) {
+                if (count > 1) {
+                    entries[images] = {{}, count};
+                }
+            }
+        }
+
+        // called once by every job as it starts, with the machine it's going to run on or null if
+        // it already has images there. Maps the shared images into machine and returns true, or
+        // false if no other job runs them and they're the caller's to load. The loading happens
+        // outside the lock, jobs on the same images wait for it. Throws if it fails, and the next
+        // job on the same images tries again
+        bool map(const std::vector<std::string> &images, LC3_Machine *machine, std::vector<std::string> &warnings) {
+            std::promise<shared_load> loading;
+            std::shared_future<shared_load> load;
+            bool loader = false;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                auto found = entries.find(images);
+                if (found == entries.end()) {
+                    return false;
+                }
+                entry &e = found->second;
+                if (machine) {
+                    if (!e.load.valid()) {
+                        e.load = loading.get_future().share();
+                        loader = true;
+                    }
+                    load = e.load;
+                }
+                if (--e.jobs_left == 0) {
+                    entries.erase(found);
+                }
+            }
+            if (!machine) {
+                return true;
+            }
+
+            if (loader) {
+                try {
+                    LC3_Machine source;
+                    shared_load l;
+                    l.warnings = load_images(images, &source).warnings;
+                    l.image = share_image(&source);
+                    loading.set_value(std::move(l));
+                }
+                catch (...) {
+                    loading.set_exception(std::current_exception());
+                    // whoever comes next starts over, the ones waiting now get this error
+                    std::lock_guard<std::mutex> guard(lock);
+                    auto found = entries.find(images);
+                    if (found != entries.end()) {
+                        found->second.load = {};
+                    }
+                }
+            }
+
+            const shared_load &l = load.get();
+            map_image(machine, *l.image);
+            warnings = l.warnings;
+            return true;
+        }
+};
+
+// the last images a worker loaded, with a snapshot of the machine right before it started. Running
+// them again (usually with different input) is a restore instead of a reload
+struct loaded_images {
+    std::vector<std::string> images;
+    std::unique_ptr<LC3_Machine> machine;
+    std::unique_ptr<LC3_Snapshot> start;
+    std::vector<std::string> warnings;
+};
+
+thread_local loaded_images worker_images;
+
+// for a job that halted, passes it unless there's expected output and it printed something else
+void check_output(job_result &result, const batch_job &job, const std::string &output, const std::string &expected) {
+    if (!job.expected.empty() && output != expected) {
+        size_t at = 0;
+        while (at < output.size() && at < expected.size() && output[at] == expected[at]) {
+            at++;
+        }
+        result.status = JOB_FAIL;
+        result.detail = "output differs at byte " + std::to_string(at) + " (got " +
+                        std::to_string(output.size()) + " bytes, expected " + std::to_string(expected.size()) + ")";
+        return;
+    }
+    result.status = JOB_PASS;
+}
+
+job_result run_job(const batch_job &job, const headless_limits &limits, Shared_Images &shared) {
+    job_result result;
+    auto start = std::chrono::steady_clock::now();
+
+    loaded_images &loaded = worker_images;
+
+    if (loaded.machine && loaded.images == job.images) {
+        // same images as last time, only the pages that run wrote need to go back
+        shared.map(job.images, nullptr, loaded.warnings);
+        restore_snapshot(loaded.machine.get(), *loaded.start);
+    }
+    else {
+        loaded.machine.reset();
+        // () so memory starts zeroed, every run of an image sees the same thing
+        std::unique_ptr<LC3_Machine> machine(new LC3_Machine());
+
+        try {
+            if (!shared.map(job.images, machine.get(), loaded.warnings)) {
+                loaded.warnings = load_images(job.images, machine.get()).warnings;
+            }
+        }
+        catch (const std::exception &e) {
+            result.detail = e.what();
+            return result;
+        }
+        init_registers(machine.get());
+
+        if (!loaded.start) {
+            loaded.start.reset(new LC3_Snapshot);
+        }
+        take_snapshot(machine.get(), *loaded.start);
+        loaded.images = job.images;
+        loaded.machine = std::move(machine);
+    }
+    result.warnings = loaded.warnings;
+
+    std::string input, expected;
+    if (!job.input.empty() && !read_file(job.input, input)) {
+        result.detail = "can't read input " + job.input + " (" + input + ")";
+        return result;
+    }
+    if (!job.expected.empty() && !read_file(job.expected, expected)) {
+        result.detail = "can't read expected output " + job.expected + " (" + expected + ")";
+        return result;
+    }
+
+    Buffer_IO io{input};
+    headless_result run = run_headless(loaded.machine.get(), io, limits);
+    result.executed = run.executed;
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    result.status = JOB_FAIL;
+
+    if (run.timed_out) {
+        result.detail = "timed out after " + std::to_string(run.executed) + " instructions, at " + hex(run.pc);
+        return result;
+    }
+    if (run.reason == EXIT_BUDGET) {
+        result.detail = "still running after " + std::to_string(run.executed) + " instructions, at " + hex(run.pc);
+        return result;
+    }
+    if (run.reason == EXIT_ILLEGAL_OPCODE) {
+        result.detail = "illegal opcode at " + hex(run.pc);
+        return result;
+    }
+
+    check_output(result, job, io.output, expected);
+    return result;
+}
+
+// a job run as a guest on the scheduler, with its whole input up front to be typed in bit by bit
+struct guest {
+    std::unique_ptr<LC3_Machine> machine;
+    std::unique_ptr<Pipe_IO> io;
+    std::string input;
+    std::string expected;
+    size_t typed = 0; // input handed to io so far, one past the end once io is closed
+    int id = -1;      // in the scheduler, -1 if it never got there
+};
+
+// a machine for job with its images, registers and io ready to go. False (and the error in result)
+// if something couldn't be read
+bool start_guest(const batch_job &job, Shared_Images &shared, guest &g, job_result &result) {
+    g.machine.reset(new LC3_Machine());
+    try {
+        if (!shared.map(job.images, g.machine.get(), result.warnings)) {
+            result.warnings = load_images(job.images, g.machine.get()).warnings;
+        }
+    }
+    catch (const std::exception &e) {
+        result.detail = e.what();
+        return false;
+    }
+    init_registers(g.machine.get());
+
+    if (!job.input.empty() && !read_file(job.input, g.input)) {
+        result.detail = "can't read input " + job.input + " (" + g.input + ")";
+        return false;
+    }
+    if (!job.expected.empty() && !read_file(job.expected, g.expected)) {
+        result.detail = "can't read expected output " + job.expected + " (" + g.expected + ")";
+        return false;
+    }
+
+    g.io.reset(new Pipe_IO());
+    g.machine->io = g.io.get();
+    return true;
+}
+
+// one line per job in manifest order, whatever order they finished in, then a summary. Returns 0 if
+// every job passed
+int report(const std::vector<batch_job> &jobs, const std::vector<job_result> &results, double total_ms,
+           unsigned workers) {
+    static const char *const names[] = {"PASS ", "FAIL ", "ERROR"};
+    int counts[3] = {0, 0, 0};
+    double busy_ms = 0;
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const job_result &r = results[i];
+        char timing[64];
+        snprintf(timing, sizeof(timing), "%10.2f ms %12llu instructions", r.ms, (unsigned long long)r.executed);
+
+        std::cout << names[r.status] << "  " << timing << "  " << jobs[i].images[0];
+        if (!r.detail.empty()) {
+            std::cout << "  (" << r.detail << ")";
+        }
+        std::cout << '\n';
+        for (const std::string &warning : r.warnings) {
+            std::cout << "       warning: " << warning << '\n';
+        }
+
+        counts[r.status]++;
+        busy_ms += r.ms;
+    }
+
+    char summary[160];
+    snprintf(summary, sizeof(summary), "%d passed, %d failed, %d errors in %.2f ms on %u threads (%.2f ms of work)",
+             counts[JOB_PASS], counts[JOB_FAIL], counts[JOB_ERROR], total_ms, workers, busy_ms);
+    std::cout << summary << std::endl;
+
+    return counts[JOB_FAIL] || counts[JOB_ERROR];
+}
+
+}
+
+std::vector<batch_job> read_manifest(const std::string &manifest) {
+    std::ifstream ifs{manifest};
+    if (!ifs) {
+        throw std::runtime_error("Invalid manifest provided");
+    }
+
+    std::string dir;
+    size_t slash = manifest.find_last_of('/');
+    if (slash != std::string::npos) {
+        dir = manifest.substr(0, slash + 1);
+    }
+    auto resolve = [&dir](const std::string &path) -> std::string {
+        if (path.empty() || path == "-") return "";
+        if (path[0] == '/') return path;
+        return dir + path;
+    };
+
+    std::vector<batch_job> jobs;
+    std::string line;
+
+    while (std::getline(ifs, line)) {
+        std::istringstream fields{line};
+        std::string image, input, expected;
+
+        if (!(fields >> image) || image[0] == '#') {
+            continue;
+        }
+        fields >> input >> expected;
+        batch_job job{{}, resolve(input), resolve(expected)};
+        std::istringstream parts{image};
+        for (std::string part; std::getline(parts, part, ',');) {
+            job.images.push_back(resolve(part));
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+int run_batch(const std::string &manifest, unsigned threads, uint64_t max_instructions, double timeout_ms) {
+    std::vector<batch_job> jobs = read_manifest(manifest);
+    std::vector<job_result> results(jobs.size());
+
+    Shared_Images shared{jobs};
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned workers;
+    {
+        Work_Pool pool{threads};
+        workers = pool.size();
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            pool.submit([&, i] { results[i] = run_job(jobs[i], {max_instructions, timeout_ms}, shared); });
+        }
+        pool.wait();
+    }
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    return report(jobs, results, total_ms, workers);
+}
+
+int run_guests(const std::string &manifest, unsigned threads, uint64_t max_instructions, double timeout_ms) {
+    std::vector<batch_job> jobs = read_manifest(manifest);
+    std::vector<job_result> results(jobs.size());
+    std::vector<guest> guests(jobs.size());
+
+    Shared_Images shared{jobs};
+    LC3_Scheduler scheduler;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (start_guest(jobs[i], shared, guests[i], results[i])) {
+            guests[i].id = scheduler.add(guests[i].machine.get(), max_instructions, timeout_ms);
+        }
+    }
+
+    // someone at each guest's keyboard, typing the next line once it has read the last one. Guests
+    // are parked in between. A guest that halts with input left just never reads it, so this stops
+    // once the scheduler is done rather than when everything has been typed
+    std::atomic<bool> done{false};
+    std::thread typist([&] {
+        while (!done) {
+            bool typed = false;
+            for (guest &g : guests) {
+                if (g.id < 0 || g.typed == g.input.size() + 1 || !g.io->drained()) {
+                    continue;
+                }
+                if (g.typed == g.input.size()) {
+                    g.io->close();
+                    g.typed++;
+                }
+                else {
+                    size_t end = std::min(g.input.find('\n', g.typed), g.input.size() - 1) + 1;
+                    g.io->give(g.input.substr(g.typed, end - g.typed));
+                    g.typed = end;
+                }
+                scheduler.wake(g.id);
+                typed = true;
+            }
+            if (!typed) {
+                std::this_thread::sleep_for(TYPING_PAUSE);
+            }
+        }
+    });
+
+    unsigned workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    scheduler.run(workers);
+    done = true;
+    typist.join();
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (guests[i].id < 0) {
+            continue;
+        }
+        const sched_task &task = scheduler.task(guests[i].id);
+        job_result &result = results[i];
+        uint16_t pc = guests[i].machine->reg[R_PC];
+        result.executed = task.executed;
+        result.ms = task.used_ms;
+        result.status = JOB_FAIL;
+
+        if (task.state == TASK_HALTED) {
+            check_output(result, jobs[i], guests[i].io->output, guests[i].expected);
+        }
+        else if (task.state == TASK_ILLEGAL_OPCODE) {
+            result.detail = "illegal opcode at " + hex(pc);
+        }
+        else if (task.state == TASK_OUT_OF_TIME) {
+            result.detail = "used up its time after " + std::to_string(task.executed) + " instructions, at " + hex(pc);
+        }
+        else {
+            result.detail = "still running after " + std::to_string(task.executed) + " instructions, at " + hex(pc);
+        }
+    }
+
+    return report(jobs, results, total_ms, workers);
+}
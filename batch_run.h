@@ -0,0 +1,36 @@
+#ifndef BATCH_RUN_H
+#define BATCH_RUN_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Batch mode: runs every image listed in a manifest, each on its own machine with its own
+// Buffer_IO (see run_headless), spread over a Work_Pool. Jobs with the same images share one
+// copy-on-write image of them (lc3_memory.h) instead of each loading their own. One line per image:
+//
+//     image[,image...] [input [expected]]
+//
+// input is fed to the program as keystrokes, expected is compared with everything it printed
+// (including the "HALT" line). Either can be "-" or left off. Paths are relative to the manifest,
+// blank lines and lines starting with '#' are skipped.
+
+struct batch_job {
+    std::vector<std::string> images; // loaded in order, see load_images
+    std::string input;    // empty if there isn't one
+    std::string expected; // empty if there isn't one
+};
+
+std::vector<batch_job> read_manifest(const std::string &manifest);
+
+// runs every job with at most max_instructions and timeout_ms (0 for no limit) each, prints a
+// pass/fail line per job and a summary. threads = 0 means one per core. Returns 0 if every job passed
+int run_batch(const std::string &manifest, unsigned threads, uint64_t max_instructions, double timeout_ms = 0);
+
+// the same jobs as guests on one LC3_Scheduler (lc3_sched.h) instead: each gets a Pipe_IO and its
+// input is typed in a line at a time, the next line once it has read the last one. In between it's
+// parked on GETC/IN or a KBSR loop. max_instructions and timeout_ms (host time spent running it) are
+// the scheduler's quotas. Reports like run_batch
+int run_guests(const std::string &manifest, unsigned threads, uint64_t max_instructions, double timeout_ms = 0);
+
+#endif
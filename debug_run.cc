@@ -1,19 +1,41 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 
 #include "debug_run.h"
 #include "lc3_run.h"
+#include "lc3_watch.h"
 
 using std::string;
 
 int debug_loop(LC3_Debugger *machine) {
-    if (machine->breakpoints.find(machine->reg[R_PC]) != machine->breakpoints.end()) {
+    if (breakpoint_at(machine->reg[R_PC], machine)) {
         machine->print_addr();
-        return handle_break(*machine);
+        if (!handle_break(*machine)) {
+            return 0;
+        }
+    }
+
+    // full speed on the threaded engine until the next breakpoint. The first instruction is never
+    // stopped on, so continuing from a breakpoint doesn't stop on it again. Watchpoints need the
+    // interpreter to notice them
+    run_result result = machine->recorder->run(UINT64_MAX, machine->stop_features());
+
+    if (result.reason == EXIT_ILLEGAL_OPCODE) {
+        throw std::runtime_error("Bad Instruction");
     }
 
-    return run_loop(machine, false);
+    if (result.reason == EXIT_WATCHPOINT) {
+        machine->print_hit();
+
+        // a breakpoint on the next instruction stops us there anyway
+        if (!breakpoint_at(machine->reg[R_PC], machine)) {
+            machine->print_addr();
+            return handle_break(*machine);
+        }
+    }
+    return result.reason != EXIT_HALTED;
 }
 
 
@@ -23,7 +45,8 @@ int handle_break(LC3_Debugger &machine) {
     int running = 1;
 
     // probably make this a do while loop
-    while (curr == "next" || curr == "n" || curr == "step" || curr == "s") {
+    while (curr == "next" || curr == "n" || curr == "step" || curr == "s" ||
+           curr == "reverse-step" || curr == "rs" || curr == "reverse-continue" || curr == "rc") {
         restore_input_buffering();
         std::cout << '>';
         prev = curr;
@@ -33,9 +56,34 @@ int handle_break(LC3_Debugger &machine) {
         curr = check_command(machine, curr, prev);
 
         if (curr == "step" || curr == "s") {
-            running = run_loop(&machine, true);
+            run_result result = machine.recorder->run(1, RUN_TRACE);
+            if (result.reason == EXIT_ILLEGAL_OPCODE) {
+                throw std::runtime_error("Bad Instruction");
+            }
+            running = result.reason != EXIT_HALTED;
             machine.print_addr();
         }
+        // back to an earlier point of the recording (lc3_replay.h), which undoes a halt too
+        else if (curr == "reverse-step" || curr == "rs") {
+            if (!machine.recorder->reverse_step()) {
+                std::cout << "Already at the start of the program" << '\n';
+            }
+            running = 1;
+            machine.print_addr();
+            continue;
+        }
+        else if (curr == "reverse-continue" || curr == "rc") {
+            run_result result = machine.recorder->reverse_continue(machine.stop_features());
+            if (result.reason == EXIT_WATCHPOINT) {
+                machine.print_hit();
+            }
+            else if (result.reason != EXIT_BREAKPOINT) {
+                std::cout << "Back at the start of the program" << '\n';
+            }
+            running = 1;
+            machine.print_addr();
+            continue;
+        }
         else if (curr == "continue" || curr == "c") {
             disable_input_buffering();
             break;
@@ -77,12 +125,49 @@ string check_command(LC3_Debugger &machine, const string &command, const string
 
         iss >> std::hex >> addr;
         
-        if (machine.breakpoints.find(addr) != machine.breakpoints.end()) std::cout << "Breakpoint at 0x" << std::hex << addr << " already exists" << '\n';
+        if (breakpoint_at(addr, &machine)) std::cout << "Breakpoint at 0x" << std::hex << addr << " already exists" << '\n';
         else {
         std::cout << "Breakpoint " << machine.num_breakpoints << " at address 0x" << std::hex << addr << '\n';
-        machine.breakpoints.insert(addr);
+        set_breakpoint(addr, &machine);
+        }
+
+        return first;
+    }
+
+    // watch <r|w|c, any mix> <first> [last], addresses in hex
+    if (first == "watch") {
+        string kinds_string;
+        uint16_t from = 0;
+        iss >> kinds_string >> std::hex >> from;
+
+        uint16_t to = from;
+        iss >> std::hex >> to;
+
+        uint8_t kinds = 0;
+        for (char c : kinds_string) {
+            if (c == 'r') kinds |= WATCH_READ;
+            else if (c == 'w') kinds |= WATCH_WRITE;
+            else if (c == 'c') kinds |= WATCH_CHANGE;
+            else kinds = 0xFF;
         }
 
+        if (kinds == 0 || kinds == 0xFF || to < from) {
+            std::cout << "Usage: watch <r|w|c> <first address> [last address]" << '\n';
+        }
+        else {
+            int id = add_watchpoint(&machine, from, to, kinds);
+            std::cout << "Watchpoint " << std::dec << id << " at 0x" << std::hex << from;
+            if (to != from) std::cout << "-0x" << to;
+            std::cout << '\n';
+        }
+        return first;
+    }
+
+    if (first == "unwatch") {
+        int id = 0;
+        iss >> std::dec >> id;
+
+        if (!remove_watchpoint(&machine, id)) std::cout << "No watchpoint " << std::dec << id << '\n';
         return first;
     }
 
@@ -91,6 +176,8 @@ string check_command(LC3_Debugger &machine, const string &command, const string
         if (first == "step" || first == "s") ;
         else if (first == "continue" || first == "c") ;
         else if (first == "next" || first == "n") ;
+        else if (first == "reverse-step" || first == "rs") ;
+        else if (first == "reverse-continue" || first == "rc") ;
         // need to add all commands these are all for now
 
         else {
@@ -30,6 +30,74 @@ uint16_t lc3_instruction::cc() const {return (data >> 9) & 0x7;}
 uint16_t lc3_instruction::get(int i, int length) const {return (data >> i) & ((1 << length) - 1);} // -1 flips bits behind the 1
 uint16_t lc3_instruction::bits() const {return data;}
 
+lc3_decoded decode(uint16_t bits) {
+    lc3_instruction instr{bits};
+    lc3_decoded d;
+
+    d.op = instr.opcode();
+    d.dr = instr.dr();
+    d.sr1 = instr.sr1();
+    d.sr2 = instr.sr2();
+
+    switch (d.op) {
+        case OP_ADD:
+        case OP_AND:
+            d.imm = instr.is_imm();
+            d.offset = instr.imm5();
+            break;
+        case OP_LDR:
+        case OP_STR:
+            d.offset = instr.offset6();
+            break;
+        case OP_BR:
+        case OP_LD:
+        case OP_LDI:
+        case OP_LEA:
+        case OP_ST:
+        case OP_STI:
+            d.offset = instr.pc_offset9();
+            break;
+        case OP_JSR:
+            d.imm = instr.is_jsr();
+            d.offset = instr.pc_offset11();
+            break;
+        case OP_TRAP:
+            d.offset = instr.vector();
+            break;
+    }
+    return d;
+}
+
+uint8_t fuse(lc3_decoded first, lc3_decoded second, lc3_decoded third) {
+    uint8_t next = base_op(second.op);
+
+    switch (first.op) {
+        case OP_ADD:
+            if (next == OP_BR && second.dr) {
+                return OP_ADD_BR;
+            }
+            break;
+        case OP_LDR:
+            if (next == OP_ADD && base_op(third.op) == OP_STR) {
+                return OP_LDR_ADD_STR;
+            }
+            break;
+        case OP_AND:
+            if (first.imm && first.offset == 0 && next == OP_ADD && second.imm &&
+                second.dr == first.dr && second.sr1 == first.dr) {
+                return OP_LOAD_IMM;
+            }
+            break;
+        case OP_NOT:
+            if (next == OP_ADD && second.imm && second.offset == 1 &&
+                second.dr == first.dr && second.sr1 == first.dr) {
+                return OP_NEGATE;
+            }
+            break;
+    }
+    return first.op;
+}
+
 uint16_t sign_extend(uint16_t x, int bit_count)
 {
     if ((x >> (bit_count - 1)) & 1) {
@@ -42,17 +110,19 @@ void swap16(uint16_t &x) {
     x = (x << 8) | (x >> 8);
 }
 
-void update_flags(uint16_t r, LC3_Machine *machine) {
-    if (machine->reg[r] == 0)
-    {
-        machine->reg[R_COND] = FL_ZRO;
+void set_flags(uint16_t flag, LC3_Machine *machine) {
+    if (flag & FL_NEG) {
+        machine->flag_value = 0x8000;
     }
-    else if (machine->reg[r] >> 15) /* a 1 in the left-most bit indicates negative */
-    {
-        machine->reg[R_COND] = FL_NEG;
+    else if (flag & FL_ZRO) {
+        machine->flag_value = 0;
     }
-    else
-    {
-        machine->reg[R_COND] = FL_POS;
+    else {
+        machine->flag_value = 1;
     }
-}
\ No newline at end of file
+    machine->reg[R_COND] = flag;
+}
+
+void materialize_flags(LC3_Machine *machine) {
+    machine->reg[R_COND] = get_flags(machine);
+}
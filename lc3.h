@@ -2,8 +2,25 @@
 #define LC3_H
 
 #include <cstdint>
+#include <vector>
+
+#include "lc3_io.h"
 #define MEMORY_MAX (1 << 16)
 
+// memory is tracked in pages of 256 words (snapshots, see lc3_snapshot.h)
+enum {
+    PAGE_SHIFT = 8,
+    PAGE_SIZE = 1 << PAGE_SHIFT,
+    PAGE_COUNT = MEMORY_MAX >> PAGE_SHIFT
+};
+
+// LC3_Machine::page_flags bits
+enum {
+    PAGE_MMIO = 1 << 0,  /* has a device on it, see lc3_bus.h */
+    PAGE_WATCH = 1 << 1, /* has a watchpoint on it, see lc3_watch.h */
+    PAGE_SLOW = PAGE_MMIO | PAGE_WATCH /* loads and stores have to go through mem_read/mem_write */
+};
+
 
 enum {
     R_R0 = 0,
@@ -45,7 +62,9 @@ enum {
 
 enum {
     MR_KBSR = 0xFE00, /* keyboard status */
-    MR_KBDR = 0xFE02  /* keyboard data */
+    MR_KBDR = 0xFE02, /* keyboard data */
+    MR_DSR = 0xFE04,  /* display status */
+    MR_DDR = 0xFE06   /* display data */
 };
 
 enum {
@@ -90,23 +109,183 @@ class lc3_instruction {
         uint16_t bits() const;
 };
 
+enum {
+    OP_UNDECODED = 16, /* decode cache slot that hasn't been filled yet */
+    OP_BREAKPOINT = 17, /* decode cache slot with a breakpoint on it, see set_breakpoint in lc3_run.h */
+
+    // superinstructions: the decode cache entry of the first instruction of a common sequence, see
+    // fuse. The fields are still the first instruction's, the rest are read from the entries after it
+    OP_ADD_BR = 18,     /* ADD, then BR (count down and loop) */
+    OP_LDR_ADD_STR,     /* LDR, ADD, STR (read, modify, write) */
+    OP_LOAD_IMM,        /* AND Rx,Ry,#0, then ADD Rx,Rx,#imm */
+    OP_NEGATE,          /* NOT Rx,Ry, then ADD Rx,Rx,#1 */
+    OP_COUNT
+};
+
+// instruction with its fields already pulled out and sign extended, so the run loop doesn't
+// redo the shifts on every fetch. These live in LC3_Machine::decoded, one per memory word
+struct lc3_decoded {
+    uint8_t op = OP_UNDECODED;
+    uint8_t dr = 0;      // DR, SR for the stores, or the nzp bits for BR
+    uint8_t sr1 = 0;     // SR1 or BaseR
+    uint8_t sr2 = 0;
+    bool imm = false;    // immediate mode for ADD/AND, PC relative mode for JSR
+    uint16_t offset = 0; // sign extended imm5, offset6, PCoffset9 or PCoffset11, or the trap vector
+};
+
+lc3_decoded decode(uint16_t bits);
+
+// the superinstruction starting with first when second and third come after it, or first.op if
+// they aren't one. Entries that are superinstructions themselves count as their first instruction
+uint8_t fuse(lc3_decoded first, lc3_decoded second, lc3_decoded third);
+
+// the instruction a superinstruction starts with, other ops as they are
+inline uint8_t base_op(uint8_t op) {
+    switch (op) {
+        case OP_ADD_BR: return OP_ADD;
+        case OP_LDR_ADD_STR: return OP_LDR;
+        case OP_LOAD_IMM: return OP_AND;
+        case OP_NEGATE: return OP_NOT;
+        default: return op;
+    }
+}
+
+// how many instructions the superinstruction op runs, 1 for anything else
+inline int fused_length(uint8_t op) {
+    return op == OP_LDR_ADD_STR ? 3 : op >= OP_ADD_BR && op < OP_COUNT ? 2 : 1;
+}
+
 uint16_t sign_extend(uint16_t x, int bit_count);
 
 void swap16(uint16_t &x);
 
+struct LC3_Jit;
+struct run_profile;
+struct LC3_Device;
+struct LC3_Trap_Table;
+
+// the standard traps, see lc3_trap.h
+const LC3_Trap_Table *default_traps();
+
+// addresses first..last (inclusive) belong to device, see lc3_bus.h
+struct mmio_region {
+    uint16_t first;
+    uint16_t last;
+    LC3_Device *device;
+};
+
+// what a watchpoint (lc3_watch.h) stops on
+enum {
+    WATCH_READ = 1 << 0,
+    WATCH_WRITE = 1 << 1,
+    WATCH_CHANGE = 1 << 2 /* writes that change the value */
+};
+
+// addresses first..last (inclusive), WATCH_* bits in kinds
+struct watchpoint {
+    int id;
+    uint16_t first;
+    uint16_t last;
+    uint8_t kinds;
+};
+
+// the access that last ran into a watchpoint, kind is 0 if there hasn't been one
+struct watch_hit {
+    int id = 0;
+    uint8_t kind = 0;
+    uint16_t address = 0;
+    uint16_t old_value = 0; // what was there before, for writes
+    uint16_t value = 0;     // what was read or written
+};
+
 struct LC3_Machine {
-    uint16_t memory[MEMORY_MAX];  /* 65536 locations */
+    uint16_t *memory;  /* 65536 locations, copy-on-write view of an LC3_Image (see lc3_memory.h) */
     uint16_t reg[R_COUNT];
-    uint16_t depth;
-    uint16_t counter;
-    
+
+    // last value written by a flag setting instruction. N/Z/P are only worked out from it when
+    // something needs them (BR, the debugger), reg[R_COND] is only filled in by materialize_flags
+    uint16_t flag_value = 0;
+    // call stack kept on the host side, one return address per JSR/JSRR we're inside of.
+    // depth is how many of those there are, 0 means we're in main
+    std::vector<uint16_t> frames;
+    uint16_t depth = 0;
+    // calls made once depth was already at UINT16_MAX, they aren't in frames. Their returns come
+    // first and pop nothing
+    uint64_t untracked = 0;
+
+    // decode cache, invalidated whenever the matching memory word changes. MEMORY_MAX entries,
+    // mapped along with memory
+    lc3_decoded *decoded;
+
+    // one bit per page written since the snapshot with id dirty_since was taken or restored
+    // (see lc3_snapshot.h), 0 if there wasn't one
+    uint64_t dirty[PAGE_COUNT / 64] = {};
+    uint64_t dirty_since = 0;
+
+    // PAGE_* bits for each page, and the devices behind the PAGE_MMIO ones (lc3_bus.h)
+    uint8_t page_flags[PAGE_COUNT] = {};
+    std::vector<mmio_region> devices;
+
+    // what sets PAGE_WATCH, and the last access one of them caught (lc3_watch.h)
+    std::vector<watchpoint> watchpoints;
+    watch_hit hit;
+
+    // one bit per address with a breakpoint, empty until the first one is set (set_breakpoint).
+    // Those addresses also hold OP_BREAKPOINT in decoded, so the engines only notice them there
+    std::vector<uint64_t> breakpoints;
+
+    // translated code, only there when running with the JIT (see lc3_jit.h)
+    LC3_Jit *jit = nullptr;
+
     
     bool debug = false;
 
-    virtual ~LC3_Machine() = default;
+    // opcode counts, only touched by run_interpreter with RUN_PROFILE. Not owned by the machine
+    run_profile *profile = nullptr;
+
+    // keyboard and display for the traps and KBSR/KBDR, the terminal unless someone swaps it out.
+    // Not owned by the machine
+    LC3_IO *io = console_io();
+
+    // what each TRAP vector does (lc3_trap.h). Not owned by the machine
+    const LC3_Trap_Table *traps = default_traps();
+
+    // GETC/IN without a key waiting make run_for return EXIT_TRAP_IO instead of blocking
+    bool yield_on_input = false;
+
+    // starts out on the blank image: memory all zero, nothing decoded, with the keyboard and
+    // display mapped (lc3_memory.cc)
+    LC3_Machine();
+    LC3_Machine(const LC3_Machine &) = delete;
+    LC3_Machine &operator=(const LC3_Machine &) = delete;
+
+    virtual ~LC3_Machine();
 
 };
 
-void update_flags(uint16_t r, LC3_Machine *machine);
+inline void mark_dirty(uint16_t address, LC3_Machine *machine) {
+    uint16_t page = address >> PAGE_SHIFT;
+    machine->dirty[page >> 6] |= 1ull << (page & 63);
+}
+
+inline bool breakpoint_at(uint16_t address, const LC3_Machine *machine) {
+    return !machine->breakpoints.empty() && (machine->breakpoints[address >> 6] >> (address & 63) & 1);
+}
+
+inline void update_flags(uint16_t r, LC3_Machine *machine) {
+    machine->flag_value = machine->reg[r];
+}
+
+// N/Z/P for the last flag setting instruction, without branching on the value
+inline uint16_t get_flags(const LC3_Machine *machine) {
+    uint16_t v = machine->flag_value;
+    return FL_POS << ((v == 0) | ((v >> 15) << 1));
+}
+
+// for setting the condition codes directly, picks a value that gives flag
+void set_flags(uint16_t flag, LC3_Machine *machine);
+
+// copies the current condition codes into reg[R_COND] for anything that reads the registers directly
+void materialize_flags(LC3_Machine *machine);
 
 #endif
\ No newline at end of file
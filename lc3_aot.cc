@@ -0,0 +1,412 @@
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_console.h"
+#include "lc3_loader.h"
+#include "lc3_aot.h"
+
+namespace {
+
+std::string hex(uint16_t value) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "0x%04X", value);
+    return buf;
+}
+
+std::string label(uint16_t address) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "L%04X", address);
+    return buf;
+}
+
+std::string reg(int r) {
+    return "r" + std::to_string(r);
+}
+
+// every instruction control can get to from PC_START without knowing register values. JMP/JSRR
+// targets aren't followed, the fall through after a JSR is (that's where RET comes back to)
+std::vector<bool> reachable(LC3_Machine *machine, const std::vector<bool> &loaded) {
+    std::vector<bool> code(MEMORY_MAX);
+    std::vector<uint16_t> work{PC_START};
+
+    while (!work.empty()) {
+        uint16_t pc = work.back();
+        work.pop_back();
+
+        if (!loaded[pc] || code[pc]) {
+            continue;
+        }
+        lc3_decoded d = decode(machine->memory[pc]);
+        if (d.op == OP_RTI || d.op == OP_RES) {
+            continue;
+        }
+        code[pc] = true;
+
+        uint16_t next = pc + 1;
+        switch (d.op) {
+            case OP_BR:
+                if (d.dr != (FL_NEG | FL_ZRO | FL_POS)) work.push_back(next);
+                if (d.dr) work.push_back(next + d.offset);
+                break;
+            case OP_JMP:
+                break;
+            case OP_JSR:
+                work.push_back(next);
+                if (d.imm) work.push_back(next + d.offset);
+                break;
+            case OP_TRAP:
+                if (d.offset != TRAP_HALT) work.push_back(next);
+                break;
+            default:
+                work.push_back(next);
+        }
+    }
+    return code;
+}
+
+// the condition for BR with these nzp bits, on the flag_value kept in f
+std::string condition(uint16_t nzp) {
+    switch (nzp) {
+        case FL_NEG: return "(int16_t)f < 0";
+        case FL_ZRO: return "f == 0";
+        case FL_POS: return "(int16_t)f > 0";
+        case FL_NEG | FL_ZRO: return "(int16_t)f <= 0";
+        case FL_ZRO | FL_POS: return "(int16_t)f >= 0";
+        case FL_NEG | FL_POS: return "f != 0";
+        default: return "true";
+    }
+}
+
+struct emitter {
+    LC3_Machine *machine;
+    const std::vector<bool> &code;
+    std::string out;
+    bool leaves = false;   // something jumps to leave
+    bool modifies = false; // or to modified, the labels are only there if they're used
+
+    void line(const std::string &text) {
+        out += "    " + text + "\n";
+    }
+
+    // control goes to address next, whether or not that's translated
+    void go(uint16_t address) {
+        if (code[address]) {
+            line("goto " + label(address) + ";");
+        }
+        else {
+            line("target = " + hex(address) + "; goto leave;");
+            leaves = true;
+        }
+    }
+
+    void instruction(uint16_t pc);
+};
+
+void emitter::instruction(uint16_t pc) {
+    lc3_decoded d = decode(machine->memory[pc]);
+    uint16_t next = pc + 1;
+    bool falls_through = true;
+
+    std::string dr = reg(d.dr), sr1 = reg(d.sr1);
+    uint16_t address = next + d.offset;
+
+    switch (d.op) {
+        case OP_ADD:
+        case OP_AND: {
+            const char *op = d.op == OP_ADD ? " + " : " & ";
+            line(dr + " = " + sr1 + op + (d.imm ? hex(d.offset) : reg(d.sr2)) + "; f = " + dr + ";");
+            break;
+        }
+
+        case OP_NOT:
+            line(dr + " = ~" + sr1 + "; f = " + dr + ";");
+            break;
+
+        case OP_BR: {
+            if (d.dr == 0) {
+                break;
+            }
+            falls_through = d.dr != (FL_NEG | FL_ZRO | FL_POS);
+            line("if (" + condition(d.dr) + ") {");
+            // waiting on the keyboard, sleep instead of spinning like the interpreter does
+            if (kbsr_poll_loop(address, machine)) {
+                line("    if (!machine->io->check_key() && !machine->io->input_ended()) machine->io->wait_key();");
+            }
+            out += "    ";
+            go(address);
+            line("}");
+            break;
+        }
+
+        case OP_JMP:
+            if (d.sr1 == R_R7) {
+                line("pop(machine);");
+            }
+            line("target = " + sr1 + "; goto dispatch;");
+            falls_through = false;
+            break;
+
+        case OP_JSR:
+            // same order as the interpreter, JSRR R7 jumps to the new R7
+            line("push(" + hex(next) + ", machine); r7 = " + hex(next) + ";");
+            if (d.imm) {
+                go(address);
+            }
+            else {
+                line("target = " + sr1 + "; goto dispatch;");
+            }
+            falls_through = false;
+            break;
+
+        case OP_LD:
+            line(dr + " = aot_load(machine, " + hex(address) + "); f = " + dr + ";");
+            break;
+
+        case OP_LDI:
+            line(dr + " = aot_load(machine, aot_load(machine, " + hex(address) + ")); f = " + dr + ";");
+            break;
+
+        case OP_LDR:
+            line(dr + " = aot_load(machine, " + sr1 + " + " + hex(d.offset) + "); f = " + dr + ";");
+            break;
+
+        case OP_LEA:
+            line(dr + " = " + hex(address) + "; f = " + dr + ";");
+            break;
+
+        case OP_ST:
+        case OP_STI:
+        case OP_STR: {
+            std::string where = d.op == OP_ST ? hex(address) :
+                                d.op == OP_STI ? "aot_load(machine, " + hex(address) + ")" :
+                                sr1 + " + " + hex(d.offset);
+            line("if (!aot_store(machine, " + where + ", " + dr + ", code)) { target = " + hex(next) + "; goto modified; }");
+            modifies = true;
+            break;
+        }
+
+        case OP_TRAP:
+            line("r7 = " + hex(next) + "; AOT_SAVE(); machine->reg[R_PC] = " + hex(next) + ";");
+            line("if (!run_trap(" + hex(d.offset) + ", machine)) return AOT_HALTED;");
+            line("AOT_LOAD();");
+            // guest trap routines move the pc
+            line("if (machine->reg[R_PC] != " + hex(next) + ") { target = machine->reg[R_PC]; goto dispatch; }");
+            falls_through = d.offset != TRAP_HALT;
+            break;
+    }
+
+    // the next label is right after this one, anything else needs a jump
+    if (falls_through && !(code[next] && next == pc + 1u)) {
+        go(next);
+    }
+}
+
+}
+
+std::string translate_program(LC3_Machine *machine, const std::vector<image_segment> &segments,
+                              const std::string &source) {
+    std::vector<bool> loaded(MEMORY_MAX);
+    for (const image_segment &s : segments) {
+        for (uint32_t i = 0; i < s.words; i++) {
+            loaded[(uint16_t)(s.origin + i)] = true;
+        }
+    }
+    std::vector<bool> code = reachable(machine, loaded);
+
+    std::string out;
+    out += "// Generated by lc3_aot from " + source + ", don't edit. Build it with the VM's objects, see lc3_aot.h\n";
+    out += "#include <cstdint>\n\n#include \"lc3.h\"\n#include \"lc3_run.h\"\n#include \"lc3_aot.h\"\n\nnamespace {\n\n";
+
+    for (size_t s = 0; s < segments.size(); s++) {
+        out += "const uint16_t segment_" + std::to_string(s) + "[] = {";
+        for (uint32_t i = 0; i < segments[s].words; i++) {
+            out += i % 12 == 0 ? "\n    " : " ";
+            out += hex(machine->memory[(uint16_t)(segments[s].origin + i)]) + ",";
+        }
+        out += "\n};\n\n";
+    }
+
+    out += "const aot_segment segments[] = {\n";
+    for (size_t s = 0; s < segments.size(); s++) {
+        out += "    {" + hex(segments[s].origin) + ", " + std::to_string(segments[s].words) + ", segment_" +
+               std::to_string(s) + "},\n";
+    }
+    out += "};\n\n";
+
+    out += "const uint64_t code[MEMORY_MAX / 64] = {";
+    for (int i = 0; i < MEMORY_MAX / 64; i++) {
+        uint64_t bits = 0;
+        for (int b = 0; b < 64; b++) {
+            bits |= (uint64_t)code[i * 64 + b] << b;
+        }
+        char buf[24];
+        snprintf(buf, sizeof(buf), "0x%llx,", (unsigned long long)bits);
+        out += i % 8 == 0 ? "\n    " : " ";
+        out += buf;
+    }
+    out += "\n};\n\n";
+
+    out += "#define AOT_SAVE() do { \\\n"
+           "        machine->reg[0] = r0; machine->reg[1] = r1; machine->reg[2] = r2; machine->reg[3] = r3; \\\n"
+           "        machine->reg[4] = r4; machine->reg[5] = r5; machine->reg[6] = r6; machine->reg[7] = r7; \\\n"
+           "        machine->flag_value = f; \\\n"
+           "    } while (0)\n"
+           "#define AOT_LOAD() do { \\\n"
+           "        r0 = machine->reg[0]; r1 = machine->reg[1]; r2 = machine->reg[2]; r3 = machine->reg[3]; \\\n"
+           "        r4 = machine->reg[4]; r5 = machine->reg[5]; r6 = machine->reg[6]; r7 = machine->reg[7]; \\\n"
+           "        f = machine->flag_value; \\\n"
+           "    } while (0)\n\n";
+
+    out += "int native(LC3_Machine *machine, uint16_t entry) {\n";
+    out += "    uint16_t r0, r1, r2, r3, r4, r5, r6, r7, f, target;\n";
+    out += "    AOT_LOAD();\n";
+    out += "    target = entry;\n";
+    out += "    goto dispatch;\n\n";
+
+    emitter e{machine, code, ""};
+    for (int pc = 0; pc < MEMORY_MAX; pc++) {
+        if (code[pc]) {
+            e.out += label(pc) + ":\n";
+            e.instruction(pc);
+        }
+    }
+    out += e.out;
+
+    out += "\ndispatch:\n    switch (target) {\n";
+    for (int pc = 0; pc < MEMORY_MAX; pc++) {
+        if (code[pc]) {
+            out += "        case " + hex(pc) + ": goto " + label(pc) + ";\n";
+        }
+    }
+    out += "    }\n";
+    out += e.leaves ? "leave:\n" : "";
+    out += "    AOT_SAVE();\n    machine->reg[R_PC] = target;\n    return AOT_EXIT;\n";
+    if (e.modifies) {
+        out += "modified:\n    AOT_SAVE();\n    machine->reg[R_PC] = target;\n    return AOT_MODIFIED;\n";
+    }
+    out += "}\n\n";
+
+    out += "const aot_program program = {segments, " + std::to_string(segments.size()) + ", code, native};\n\n}\n\n";
+    out += "int main() {\n    return aot_main(program);\n}\n";
+    return out;
+}
+
+int run_aot(LC3_Machine *machine, const aot_program &program) {
+    auto translated = [&program](uint16_t address) {
+        return program.code[address >> 6] >> (address & 63) & 1;
+    };
+
+    // what the translated code was made from, later segments win like they do when loading
+    std::vector<uint16_t> original(MEMORY_MAX);
+    for (int s = 0; s < program.segment_count; s++) {
+        const aot_segment &segment = program.segments[s];
+        for (uint32_t i = 0; i < segment.words; i++) {
+            original[(uint16_t)(segment.origin + i)] = segment.data[i];
+        }
+    }
+
+    // pages the interpreter wrote in its last stretch, like LC3_Machine::dirty
+    uint64_t written[PAGE_COUNT / 64];
+
+    // true if a page in written has translated code that changed
+    auto stale = [&] {
+        for (int i = 0; i < PAGE_COUNT / 64; i++) {
+            for (uint64_t bits = written[i]; bits; bits &= bits - 1) {
+                int first = (i * 64 + std::countr_zero(bits)) << PAGE_SHIFT;
+                for (int address = first; address < first + PAGE_SIZE; address++) {
+                    if (translated(address) && machine->memory[address] != original[address]) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    };
+
+    // every translated address stops the interpreter, so it hands back as soon as it gets to one
+    for (int address = 0; address < MEMORY_MAX; address++) {
+        if (translated(address)) {
+            set_breakpoint(address, machine);
+        }
+    }
+    bool native = true;
+
+    // the translation doesn't match memory anymore, the interpreter has it from here
+    auto leave_native = [&] {
+        native = false;
+        for (int address = 0; address < MEMORY_MAX; address++) {
+            clear_breakpoint(address, machine);
+        }
+    };
+
+    while (true) {
+        if (native && translated(machine->reg[R_PC])) {
+            int result = program.native(machine, machine->reg[R_PC]);
+
+            if (result == AOT_HALTED) {
+                return 0;
+            }
+            if (result == AOT_MODIFIED) {
+                leave_native();
+            }
+            continue;
+        }
+
+        // the interpreter's stores don't go through aot_store, so look at what it wrote once it hands
+        // back. It only shows in the dirty bits, which belong to the snapshots: they're set aside for
+        // the stretch and put back with whatever it added
+        uint64_t dirty[PAGE_COUNT / 64];
+        if (native) {
+            std::memcpy(dirty, machine->dirty, sizeof(dirty));
+            std::memset(machine->dirty, 0, sizeof(machine->dirty));
+        }
+
+        run_result result = run_for(machine, UINT64_MAX);
+
+        if (native) {
+            for (int i = 0; i < PAGE_COUNT / 64; i++) {
+                written[i] = machine->dirty[i];
+                machine->dirty[i] |= dirty[i];
+            }
+        }
+        if (result.reason == EXIT_HALTED) {
+            return 0;
+        }
+        if (result.reason == EXIT_ILLEGAL_OPCODE) {
+            throw std::runtime_error("Bad Instruction");
+        }
+        if (native && stale()) {
+            leave_native();
+        }
+    }
+}
+
+int aot_main(const aot_program &program) {
+    LC3_Machine *machine = new LC3_Machine();
+
+    for (int s = 0; s < program.segment_count; s++) {
+        const aot_segment &segment = program.segments[s];
+        for (uint32_t i = 0; i < segment.words; i++) {
+            machine->memory[(uint16_t)(segment.origin + i)] = segment.data[i];
+        }
+    }
+    clear_decoded(machine);
+    init_registers(machine);
+
+    signal(SIGINT, handle_interrupt);
+    disable_input_buffering();
+
+    run_aot(machine, program);
+
+    delete machine;
+    restore_input_buffering();
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef LC3_AOT_H
+#define LC3_AOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_loader.h"
+
+// Ahead of time translation to C++. translate_program walks the loaded images from PC_START and
+// turns every instruction it can reach into a labelled block of C++, with registers kept in locals,
+// direct branches as gotos and JMP/JSRR/RET going through a switch over every translated address.
+// The result is built together with the VM's objects (everything but vm.o) into a program of its own:
+//
+//     ./lc3_aot prog.obj prog_aot.cc && make prog_aot
+//
+// Anything it couldn't reach statically runs on the threaded engine, which hands back as soon as it
+// gets to a translated address again. A store into translated code, from either side (aot_store in
+// the native code, dirty pages checked after each stretch on the threaded engine), leaves the native
+// code for good and finishes the program in the interpreter.
+
+// what the generated function returns
+enum {
+    AOT_HALTED,  // TRAP_HALT ran
+    AOT_EXIT,    // reg[R_PC] isn't translated (or is RTI/RES), the interpreter takes it from there
+    AOT_MODIFIED // something wrote over translated code, reg[R_PC] is right after the store
+};
+
+// runs translated code starting at entry, which has to be in code
+typedef int (*aot_function)(LC3_Machine *machine, uint16_t entry);
+
+// words to put at origin, as they were when the program was translated
+struct aot_segment {
+    uint16_t origin;
+    uint32_t words;
+    const uint16_t *data;
+};
+
+struct aot_program {
+    const aot_segment *segments;
+    int segment_count;
+    const uint64_t *code; // one bit per translated address
+    aot_function native;
+};
+
+// the generated code's loads and stores. Pages with devices or watchpoints go through
+// mem_read/mem_write, everything else is a plain access
+inline uint16_t aot_load(LC3_Machine *machine, uint16_t address) {
+    if (machine->page_flags[address >> PAGE_SHIFT]) {
+        return mem_read(address, machine);
+    }
+    return machine->memory[address];
+}
+
+// false if address held translated code, the store happened but the native code is out of date
+inline bool aot_store(LC3_Machine *machine, uint16_t address, uint16_t val, const uint64_t *code) {
+    if (machine->page_flags[address >> PAGE_SHIFT]) {
+        mem_write(address, val, machine);
+    }
+    else {
+        machine->memory[address] = val;
+        mark_dirty(address, machine);
+        if (machine->decoded[address].op != OP_UNDECODED) {
+            invalidate_decoded(address, machine);
+        }
+    }
+    return !(code[address >> 6] >> (address & 63) & 1);
+}
+
+// condition codes from the last flag setting result, like get_flags
+inline uint16_t aot_flags(uint16_t flag_value) {
+    return FL_POS << ((flag_value == 0) | ((flag_value >> 15) << 1));
+}
+
+// C++ source for everything in machine reachable from PC_START. segments says what to embed,
+// source is only used in the header comment
+std::string translate_program(LC3_Machine *machine, const std::vector<image_segment> &segments,
+                              const std::string &source);
+
+// runs program until it halts, switching between the native code and the interpreter
+int run_aot(LC3_Machine *machine, const aot_program &program);
+
+// main() of a translated program: loads the embedded images, sets up the console and runs it
+int aot_main(const aot_program &program);
+
+#endif
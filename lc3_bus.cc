@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_jit.h"
+#include "lc3_bus.h"
+
+namespace {
+
+struct Keyboard_Device : LC3_Device {
+    uint16_t read(uint16_t address, LC3_Machine *machine) override {
+        // status is refreshed on every read and the key is latched into KBDR, both stay in memory
+        // like ordinary words so snapshots keep them
+        if (address == MR_KBSR) {
+            mark_dirty(MR_KBSR, machine); // KBDR is on the same page
+            if (machine->io->check_key()) {
+                machine->memory[MR_KBSR] = (1 << 15);
+                machine->memory[MR_KBDR] = machine->io->read_key();
+            }
+            else {
+                machine->memory[MR_KBSR] = 0;
+            }
+        }
+        return machine->memory[address];
+    }
+
+    void write(uint16_t address, uint16_t val, LC3_Machine *machine) override {
+        machine->memory[address] = val;
+        mark_dirty(address, machine);
+    }
+};
+
+struct Display_Device : LC3_Device {
+    uint16_t read(uint16_t address, LC3_Machine *machine) override {
+        // output is buffered, the display is always ready
+        return address == MR_DSR ? (1 << 15) : machine->memory[address];
+    }
+
+    void write(uint16_t address, uint16_t val, LC3_Machine *machine) override {
+        if (address == MR_DDR) {
+            machine->io->put((char)val);
+        }
+    }
+};
+
+const mmio_region *find_region(uint16_t address, LC3_Machine *machine) {
+    // newest first, later mappings cover older ones
+    for (auto it = machine->devices.rbegin(); it != machine->devices.rend(); ++it) {
+        if (it->first <= address && address <= it->last) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+// PAGE_MMIO for every page still touched by a device
+void update_page_flags(LC3_Machine *machine) {
+    bool mmio[PAGE_COUNT] = {};
+    for (const mmio_region &r : machine->devices) {
+        for (int page = r.first >> PAGE_SHIFT; page <= r.last >> PAGE_SHIFT; page++) {
+            mmio[page] = true;
+        }
+    }
+
+    bool changed = false;
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        if (mmio[page] == bool(machine->page_flags[page] & PAGE_MMIO)) {
+            continue;
+        }
+        machine->page_flags[page] ^= PAGE_MMIO;
+        changed = true;
+
+        // decodes cached from this page went straight to memory
+        for (int i = 0; i < PAGE_SIZE; i++) {
+            invalidate_decoded((page << PAGE_SHIFT) + i, machine);
+        }
+    }
+
+    // and so did translated loads from it
+    if (changed) {
+        jit_flush(machine);
+    }
+}
+}
+
+void map_device(LC3_Machine *machine, uint16_t first, uint16_t last, LC3_Device *device) {
+    machine->devices.push_back({first, last, device});
+    update_page_flags(machine);
+}
+
+void unmap_device(LC3_Machine *machine, LC3_Device *device) {
+    std::erase_if(machine->devices, [device](const mmio_region &r) { return r.device == device; });
+    update_page_flags(machine);
+}
+
+uint16_t bus_read(uint16_t address, LC3_Machine *machine) {
+    const mmio_region *r = find_region(address, machine);
+    return r ? r->device->read(address, machine) : machine->memory[address];
+}
+
+void bus_write(uint16_t address, uint16_t val, LC3_Machine *machine) {
+    const mmio_region *r = find_region(address, machine);
+    if (r) {
+        r->device->write(address, val, machine);
+        return;
+    }
+    machine->memory[address] = val;
+    mark_dirty(address, machine);
+    invalidate_decoded(address, machine);
+}
+
+LC3_Device *keyboard_device() {
+    static Keyboard_Device keyboard;
+    return &keyboard;
+}
+
+LC3_Device *display_device() {
+    static Display_Device display;
+    return &display;
+}
@@ -0,0 +1,35 @@
+#ifndef LC3_BUS_H
+#define LC3_BUS_H
+
+#include <cstdint>
+
+#include "lc3.h"
+
+// Memory mapped devices. Each device claims a range of addresses, and every page with a device on
+// it gets PAGE_MMIO in LC3_Machine::page_flags. mem_read/mem_write only go looking for a device when
+// that flag is set, everything else (and every instruction fetch, which comes from the decode cache)
+// goes straight to memory.
+
+struct LC3_Device {
+    virtual uint16_t read(uint16_t address, LC3_Machine *machine) = 0;
+    virtual void write(uint16_t address, uint16_t val, LC3_Machine *machine) = 0;
+
+    virtual ~LC3_Device() = default;
+};
+
+// device handles first..last from now on, ahead of anything mapped there before. Not owned, has to
+// outlive the mapping
+void map_device(LC3_Machine *machine, uint16_t first, uint16_t last, LC3_Device *device);
+
+// drops every range device was mapped to
+void unmap_device(LC3_Machine *machine, LC3_Device *device);
+
+// mem_read/mem_write for addresses on a PAGE_MMIO page. Anything no device claims is plain memory
+uint16_t bus_read(uint16_t address, LC3_Machine *machine);
+void bus_write(uint16_t address, uint16_t val, LC3_Machine *machine);
+
+// the standard LC-3 devices, every machine starts with these mapped. Both use LC3_Machine::io
+LC3_Device *keyboard_device(); // KBSR/KBDR
+LC3_Device *display_device();  // DSR/DDR
+
+#endif
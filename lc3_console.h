@@ -0,0 +1,30 @@
+#ifndef LC3_CONSOLE_H
+#define LC3_CONSOLE_H
+
+#include <cstdint>
+
+// Host console, one implementation per platform (lc3_console_posix.cc, lc3_console_win.cc).
+// On POSIX a reader thread moves keystrokes into a ring buffer while input buffering is disabled,
+// so checking for a key never blocks or makes a syscall.
+
+// raw mode (no echo, no line buffering) and start collecting keys
+void disable_input_buffering();
+
+// back to how the terminal was, keys that were already collected stay queued
+void restore_input_buffering();
+
+// 1 if a key is waiting
+uint16_t check_key();
+
+// next key, waits for one if there isn't any. Returns -1 once input is closed
+int read_key();
+
+// true once input is closed and every key has been read, read_key won't wait anymore
+bool input_ended();
+
+// sleeps until there's a key waiting or input has ended
+void wait_key();
+
+void handle_interrupt(int signal);
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef _WIN32
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "lc3_console.h"
+
+namespace {
+
+const uint32_t RING_SIZE = 4096; // power of two, indices just count up and get masked
+
+// keys read by the reader thread and not taken by the VM yet. One producer (the reader thread),
+// one consumer (the VM), so two atomic counters are all the synchronisation it needs
+struct key_ring {
+    char buf[RING_SIZE];
+    std::atomic<uint32_t> head{0}; // bumped by the reader after filling a slot
+    std::atomic<uint32_t> tail{0}; // bumped by the VM after taking a slot
+};
+
+key_ring ring;
+
+// bumped whenever the reader has news (keys, or input closed), read_key sleeps on it
+std::atomic<uint32_t> events{0};
+std::atomic<bool> input_closed{false};
+std::atomic<bool> stopping{false};
+
+std::thread reader;
+int wake_pipe[2] = {-1, -1};
+
+struct termios old_tio;
+bool have_tio = false;
+
+void announce() {
+    events.fetch_add(1, std::memory_order_release);
+    events.notify_all();
+}
+
+void reader_loop() {
+    pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+    char chunk[256];
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+        if (!fds[0].revents) continue;
+
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            input_closed = true;
+            announce();
+            break;
+        }
+
+        uint32_t head = ring.head.load(std::memory_order_relaxed);
+        for (ssize_t i = 0; i < n; i++) {
+            // full, give the VM a moment to catch up
+            while (head - ring.tail.load(std::memory_order_acquire) == RING_SIZE) {
+                if (stopping) return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ring.buf[head & (RING_SIZE - 1)] = chunk[i];
+            ring.head.store(++head, std::memory_order_release);
+        }
+        announce();
+    }
+}
+
+int take_key() {
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (ring.head.load(std::memory_order_acquire) == tail) {
+        return -1;
+    }
+    int c = (unsigned char)ring.buf[tail & (RING_SIZE - 1)];
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return c;
+}
+
+}
+
+void disable_input_buffering() {
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &old_tio) == 0) {
+        have_tio = true;
+
+        struct termios new_tio = old_tio;
+        new_tio.c_lflag &= ~(ICANON | ECHO); /* no line buffering, no echo */
+        tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
+    }
+
+    if (!reader.joinable() && !input_closed && pipe(wake_pipe) == 0) {
+        stopping = false;
+        reader = std::thread(reader_loop);
+    }
+}
+
+void restore_input_buffering() {
+    if (reader.joinable()) {
+        stopping = true;
+        char b = 0;
+        (void)!write(wake_pipe[1], &b, 1);
+        reader.join();
+
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+    }
+
+    if (have_tio) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+    }
+}
+
+uint16_t check_key() {
+    return ring.head.load(std::memory_order_acquire) != ring.tail.load(std::memory_order_relaxed);
+}
+
+int read_key() {
+    while (true) {
+        uint32_t seen = events.load(std::memory_order_acquire);
+
+        int c = take_key();
+        if (c >= 0) return c;
+        if (input_closed) return -1;
+
+        // nobody is filling the ring (buffering is back on, e.g. while the debugger has the terminal)
+        if (!reader.joinable()) {
+            char b;
+            return read(STDIN_FILENO, &b, 1) == 1 ? (unsigned char)b : -1;
+        }
+
+        events.wait(seen, std::memory_order_acquire);
+    }
+}
+
+void wait_key() {
+    while (true) {
+        uint32_t seen = events.load(std::memory_order_acquire);
+        if (check_key() || input_closed) return;
+
+        // same as read_key, nobody is filling the ring so wait on stdin itself
+        if (!reader.joinable()) {
+            pollfd fd = {STDIN_FILENO, POLLIN, 0};
+            while (poll(&fd, 1, -1) < 0 && errno == EINTR) {}
+            return;
+        }
+
+        events.wait(seen, std::memory_order_acquire);
+    }
+}
+
+bool input_ended() {
+    return input_closed && !check_key();
+}
+
+void handle_interrupt(int signal) {
+    // only async signal safe calls in here, the reader thread just dies with the process
+    if (have_tio) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+    }
+    (void)!write(STDOUT_FILENO, "\n", 1);
+    _exit(-2);
+}
+
+#endif
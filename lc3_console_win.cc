@@ -0,0 +1,58 @@
+#ifdef _WIN32
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <Windows.h>
+#include <conio.h>
+
+#include "lc3_console.h"
+
+HANDLE hStdin = INVALID_HANDLE_VALUE;
+DWORD fdwMode, fdwOldMode;
+bool stdin_ended = false;
+
+void disable_input_buffering() {
+    hStdin = GetStdHandle(STD_INPUT_HANDLE);
+    GetConsoleMode(hStdin, &fdwOldMode); /* save old mode */
+    fdwMode = fdwOldMode
+            ^ ENABLE_ECHO_INPUT  /* no input echo */
+            ^ ENABLE_LINE_INPUT; /* return when one or
+                                    more characters are available */
+    SetConsoleMode(hStdin, fdwMode); /* set new mode */
+    FlushConsoleInputBuffer(hStdin); /* clear buffer */
+}
+
+void restore_input_buffering() {
+    SetConsoleMode(hStdin, fdwOldMode);
+}
+
+uint16_t check_key() {
+    return WaitForSingleObject(hStdin, 1000) == WAIT_OBJECT_0 && _kbhit();
+}
+
+int read_key() {
+    int c = getchar();
+    if (c == EOF) {
+        stdin_ended = true;
+    }
+    return c;
+}
+
+void wait_key() {
+    while (!stdin_ended && !_kbhit()) {
+        WaitForSingleObject(hStdin, INFINITE);
+    }
+}
+
+bool input_ended() {
+    return stdin_ended;
+}
+
+void handle_interrupt(int signal) {
+    restore_input_buffering();
+    printf("\n");
+    exit(-2);
+}
+
+#endif
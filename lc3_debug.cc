@@ -10,6 +10,9 @@
 #include "lc3_debug.h"
 
 void LC3_Debugger::print_addr() {
+    // guest output first, so it shows up before what the debugger prints
+    io->flush();
+    materialize_flags(this);
     uint16_t flag = reg[R_COND];
     std::cout << "Flag is currently ";
 
@@ -25,4 +28,17 @@ void LC3_Debugger::print_addr() {
     std::cout << "0x" << std::hex << flag << '\n';
 
     std::cout << "Currently at address: " << reg[R_PC] << '\n';
-}
\ No newline at end of file
+}
+
+void LC3_Debugger::print_hit() {
+    io->flush();
+    std::cout << "Watchpoint " << std::dec << hit.id;
+
+    if (hit.kind == WATCH_READ) {
+        std::cout << ": read 0x" << std::hex << hit.value << " at 0x" << hit.address << '\n';
+    }
+    else {
+        std::cout << (hit.kind == WATCH_CHANGE ? ": changed" : ": write") << " at 0x" << std::hex << hit.address
+                  << ", 0x" << hit.old_value << " -> 0x" << hit.value << '\n';
+    }
+}
@@ -2,20 +2,30 @@
 #define LC3_DEBUG_H
 
 #include "lc3.h"
-#include <unordered_set>
 #include "lc3_run.h"
+#include "lc3_replay.h"
 
 struct LC3_Debugger: public LC3_Machine {
-    // breakpoints
+    // breakpoints themselves are in LC3_Machine::breakpoints (set_breakpoint)
     int num_breakpoints;
-    std::unordered_set<uint16_t> breakpoints;
 
     // used for commands before running and before having ran
     bool running = false;
 
+    // everything runs through this once the program starts, so we can go backwards. Not owned
+    LC3_Recorder *recorder = nullptr;
+
+    // what continuing stops on: breakpoints, and watchpoints once there are any
+    unsigned stop_features() const {
+        return watchpoints.empty() ? RUN_BREAKPOINTS : RUN_BREAKPOINTS | RUN_WATCH;
+    }
+
     // print current R_PC address
     void print_addr();
 
+    // print the access in hit, after a watchpoint stopped us
+    void print_hit();
+
 };
 
 
@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_headless.h"
+
+namespace {
+
+// instructions between looks at the clock, a few ms worth
+const uint64_t TIMEOUT_CHUNK = 1 << 20;
+
+}
+
+headless_result run_headless(LC3_Machine *machine, LC3_IO &io, const headless_limits &limits,
+                             bool interpret, unsigned features) {
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start] {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    LC3_IO *old_io = machine->io;
+    machine->io = &io;
+
+    headless_result result{EXIT_BUDGET, false, machine->reg[R_PC], 0, 0};
+
+    while (true) {
+        uint64_t budget = limits.max_instructions - result.executed;
+        if (limits.timeout_ms > 0) {
+            budget = std::min(budget, TIMEOUT_CHUNK);
+        }
+
+        run_result run = interpret ? run_interpreter(machine, budget, features) : run_for(machine, budget);
+        result.reason = run.reason;
+        result.pc = run.pc;
+        result.executed += run.executed;
+
+        if (run.reason != EXIT_BUDGET || result.executed == limits.max_instructions) {
+            break;
+        }
+        if (elapsed_ms() >= limits.timeout_ms) {
+            result.timed_out = true;
+            break;
+        }
+    }
+
+    machine->io = old_io;
+    result.ms = elapsed_ms();
+    return result;
+}
@@ -0,0 +1,35 @@
+#ifndef LC3_HEADLESS_H
+#define LC3_HEADLESS_H
+
+#include <cstdint>
+
+#include "lc3.h"
+#include "lc3_io.h"
+#include "lc3_run.h"
+
+// Unattended runs: the keyboard is whatever is left in a Buffer_IO's input, output is collected into
+// it byte for byte, and nothing touches the terminal (no raw mode, no reader thread, no signal
+// handler). Once the input runs out GETC/IN get -1 and KBSR never shows a key, so the guest can't
+// block, it can only halt or run into a limit.
+
+struct headless_limits {
+    uint64_t max_instructions = UINT64_MAX;
+    double timeout_ms = 0; // wall clock, 0 for none
+};
+
+struct headless_result {
+    run_exit reason;        // EXIT_BUDGET if it hit either limit
+    bool timed_out = false; // the limit it hit was timeout_ms
+    uint16_t pc;
+    uint64_t executed;
+    double ms;
+};
+
+// runs machine with io as its keyboard and display, until it halts, hits an illegal opcode or a limit.
+// io is normally a Buffer_IO, or something wrapping one (Record_IO). It runs on the threaded engine,
+// or with interpret on the switch interpreter with the RUN_* features (and the JIT if the machine has
+// one attached). machine->io is put back afterwards
+headless_result run_headless(LC3_Machine *machine, LC3_IO &io, const headless_limits &limits,
+                             bool interpret = false, unsigned features = 0);
+
+#endif
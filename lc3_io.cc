@@ -0,0 +1,85 @@
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "lc3_io.h"
+#include "lc3_console.h"
+#include "lc3_output.h"
+
+namespace {
+
+struct Console_IO : LC3_IO {
+    uint16_t check_key() override { return ::check_key(); }
+    int read_key() override { return ::read_key(); }
+    bool input_ended() override { return ::input_ended(); }
+    void wait_key() override { ::wait_key(); }
+    void write(const char *data, size_t n) override { output_write(data, n); }
+    void flush() override { output_flush(); }
+};
+
+}
+
+LC3_IO *console_io() {
+    static Console_IO console;
+    return &console;
+}
+
+uint16_t Buffer_IO::check_key() {
+    return input_pos < input.size();
+}
+
+int Buffer_IO::read_key() {
+    if (input_pos == input.size()) {
+        return -1;
+    }
+    return (unsigned char)input[input_pos++];
+}
+
+void Buffer_IO::write(const char *data, size_t n) {
+    output.append(data, n);
+}
+
+void Pipe_IO::give(const std::string &bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    input += bytes;
+    arrived.notify_all();
+}
+
+void Pipe_IO::close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    arrived.notify_all();
+}
+
+uint16_t Pipe_IO::check_key() {
+    std::lock_guard<std::mutex> guard(lock);
+    return input_pos < input.size();
+}
+
+int Pipe_IO::read_key() {
+    std::unique_lock<std::mutex> guard(lock);
+    arrived.wait(guard, [this] { return input_pos < input.size() || closed; });
+    if (input_pos == input.size()) {
+        return -1;
+    }
+    return (unsigned char)input[input_pos++];
+}
+
+bool Pipe_IO::drained() {
+    std::lock_guard<std::mutex> guard(lock);
+    return input_pos == input.size();
+}
+
+bool Pipe_IO::input_ended() {
+    std::lock_guard<std::mutex> guard(lock);
+    return closed && input_pos == input.size();
+}
+
+void Pipe_IO::wait_key() {
+    std::unique_lock<std::mutex> guard(lock);
+    arrived.wait(guard, [this] { return input_pos < input.size() || closed; });
+}
+
+void Pipe_IO::write(const char *data, size_t n) {
+    output.append(data, n);
+}
@@ -0,0 +1,83 @@
+#ifndef LC3_IO_H
+#define LC3_IO_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Where a machine's keyboard and display go. The trap routines and KBSR only ever talk to
+// LC3_Machine::io, so machines running side by side (batch mode) each get their own.
+struct LC3_IO {
+    // 1 if a key is waiting
+    virtual uint16_t check_key() = 0;
+
+    // next key, waits for one if there isn't any. Returns -1 once input is closed
+    virtual int read_key() = 0;
+
+    // true once read_key would return -1 straight away instead of waiting
+    virtual bool input_ended() = 0;
+
+    // sleeps until check_key or input_ended would say yes
+    virtual void wait_key() = 0;
+
+    virtual void write(const char *data, size_t n) = 0;
+
+    // called before reading input and on halt
+    virtual void flush() = 0;
+
+    void put(char c) { write(&c, 1); }
+
+    virtual ~LC3_IO() = default;
+};
+
+// the host terminal, through lc3_console.h and lc3_output.h. Every machine starts out on this one
+LC3_IO *console_io();
+
+// input comes from a string, output is collected into one. Nothing here touches the terminal
+struct Buffer_IO : LC3_IO {
+    std::string input;
+    size_t input_pos = 0;
+    std::string output;
+
+    Buffer_IO() = default;
+    explicit Buffer_IO(std::string input) : input(std::move(input)) {}
+
+    uint16_t check_key() override;
+    int read_key() override;
+    bool input_ended() override { return input_pos == input.size(); }
+    void wait_key() override {} // nothing more ever shows up
+    void write(const char *data, size_t n) override;
+    void flush() override {}
+};
+
+// input handed over from another thread as it comes in, for guests on an LC3_Scheduler (lc3_sched.h),
+// output collected like Buffer_IO. Input ends once close has been called and everything given
+// before it has been read
+struct Pipe_IO : LC3_IO {
+    std::string output; // only safe to look at once the guest is done
+
+    // both from any thread. Call LC3_Scheduler::wake after them
+    void give(const std::string &bytes);
+    void close();
+
+    // true once everything given so far has been read
+    bool drained();
+
+    uint16_t check_key() override;
+    int read_key() override;
+    bool input_ended() override;
+    void wait_key() override;
+    void write(const char *data, size_t n) override;
+    void flush() override {}
+
+    private:
+        std::mutex lock;
+        std::condition_variable arrived;
+        std::string input;
+        size_t input_pos = 0;
+        bool closed = false;
+};
+
+#endif
@@ -0,0 +1,753 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_jit.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LC3_JIT_X64 1
+#endif
+
+#ifdef LC3_JIT_X64
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+const int JIT_THRESHOLD = 50;          // backward branches to an address before we translate it
+const uint8_t HEAT_NEVER = 0xFF;       // address can't start a block (starts with a TRAP, etc.)
+const int MAX_BLOCK_INSTRUCTIONS = 128;
+const size_t CODE_SIZE = 16 << 20;
+const size_t MAX_BLOCK_CODE = 64 << 10; // more than any block can need, checked before translating
+const int64_t ENTRY_BUDGET = 1 << 20;  // instructions per trip into native code before we give control back
+
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_NS = 0x9, CC_L = 0xC, CC_LE = 0xE, CC_G = 0xF };
+
+#ifdef _WIN32
+const int ARG0 = RCX, ARG1 = RDX, ARG2 = R8;
+const int FRAME_PAD = 40; // shadow space, plus keeping rsp 16 byte aligned
+#else
+const int ARG0 = RDI, ARG1 = RSI, ARG2 = RDX;
+const int FRAME_PAD = 8;
+#endif
+
+// host registers that stay pinned while native code runs. All callee saved, so helper calls keep them
+const int REG_BASE = RBX; // &machine->reg[0], guest registers stay in memory
+const int MACHINE = R12;
+const int BUDGET = R13;   // instructions left before going back to the interpreter
+const int ENTRIES = R14;  // &jit->entry[0]
+const int MEMORY = R15;   // &machine->memory[0]
+
+// what the trampoline loads into the pinned registers, passed by pointer so it's the same on every ABI
+struct jit_context {
+    uint16_t *reg;
+    LC3_Machine *machine;
+    int64_t budget;
+    uint8_t **entries;
+    uint16_t *memory;
+    uint8_t *code;
+};
+
+struct jit_block;
+
+// a jmp/jcc at the end of a block whose rel32 either points at its stub (which goes back to the
+// interpreter with R_PC = target) or straight at the translated target block
+struct jit_link {
+    jit_block *from;
+    uint8_t *site;
+    uint8_t *stub;
+    uint16_t target;
+};
+
+struct jit_block {
+    uint16_t start;
+    uint16_t end; // last address covered
+    uint8_t *code;
+    bool valid = true;
+    std::vector<jit_link *> incoming;
+};
+
+void patch_rel32(uint8_t *site, const uint8_t *target) {
+    int32_t rel = (int32_t)(target - (site + 4));
+    std::memcpy(site, &rel, 4);
+}
+
+// just enough of an x86-64 assembler for what the translator emits
+struct emitter {
+    uint8_t *p;
+    int8_t flag_disp; // where machine->flag_value sits relative to REG_BASE
+
+    void byte(uint8_t b) { *p++ = b; }
+    void imm16(uint16_t v) { std::memcpy(p, &v, 2); p += 2; }
+    void imm32(uint32_t v) { std::memcpy(p, &v, 4); p += 4; }
+    void imm64(uint64_t v) { std::memcpy(p, &v, 8); p += 8; }
+
+    void rex(bool w, int r, int x, int b, bool force = false) {
+        uint8_t v = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+        if (v != 0x40 || force) byte(v);
+    }
+    void modrm(int mod, int r, int rm) { byte((mod << 6) | ((r & 7) << 3) | (rm & 7)); }
+
+    // reg op reg
+    void rr(bool w, uint8_t opcode, int r, int rm) { rex(w, r, 0, rm); byte(opcode); modrm(3, r, rm); }
+
+    void push(int r) { rex(false, 0, 0, r); byte(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, 0, r); byte(0x58 + (r & 7)); }
+    void ret() { byte(0xC3); }
+
+    // mov dst, [base + disp8], base must not be rsp/r12
+    void load64(int dst, int base, int8_t disp) { rex(true, dst, 0, base); byte(0x8B); modrm(1, dst, base); byte(disp); }
+    // jmp [base + disp8]
+    void jmp_mem(int base, int8_t disp) { rex(false, 0, 0, base); byte(0xFF); modrm(1, 4, base); byte(disp); }
+
+    void add_rsp(int8_t v) { byte(0x48); byte(0x83); modrm(3, 0, RSP); byte(v); }
+    void sub_rsp(int8_t v) { byte(0x48); byte(0x83); modrm(3, 5, RSP); byte(v); }
+
+    void mov64(int dst, int src) { rr(true, 0x89, src, dst); }
+    void mov32(int dst, int src) { rr(false, 0x89, src, dst); }
+    void mov_imm32(int dst, uint32_t v) { rex(false, 0, 0, dst); byte(0xB8 + (dst & 7)); imm32(v); }
+    void mov_imm64(int dst, uint64_t v) { rex(true, 0, 0, dst); byte(0xB8 + (dst & 7)); imm64(v); }
+    void add32(int dst, int src) { rr(false, 0x01, src, dst); }
+    void and32(int dst, int src) { rr(false, 0x21, src, dst); }
+    void alu_imm32(bool w, int ext, int dst, uint32_t v) { rex(w, 0, 0, dst); byte(0x81); modrm(3, ext, dst); imm32(v); }
+    void add_imm32(int dst, uint32_t v) { alu_imm32(false, 0, dst, v); }
+    void and_imm32(int dst, uint32_t v) { alu_imm32(false, 4, dst, v); }
+    void cmp_imm32(int dst, uint32_t v) { alu_imm32(false, 7, dst, v); }
+    void add64_imm32(int dst, uint32_t v) { alu_imm32(true, 0, dst, v); }
+    void sub64_imm32(int dst, uint32_t v) { alu_imm32(true, 5, dst, v); }
+    void shr32(int r, uint8_t n) { rex(false, 0, 0, r); byte(0xC1); modrm(3, 5, r); byte(n); }
+    void not32(int r) { rex(false, 0, 0, r); byte(0xF7); modrm(3, 2, r); }
+    void test16(int r) { byte(0x66); rr(false, 0x85, r, r); }
+    void test32(int r) { rr(false, 0x85, r, r); }
+    void test64(int r) { rr(true, 0x85, r, r); }
+    void movzx16(int dst, int src) { rex(false, dst, 0, src); byte(0x0F); byte(0xB7); modrm(3, dst, src); }
+    void call(int r) { rex(false, 0, 0, r); byte(0xFF); modrm(3, 2, r); }
+    void jmp_reg(int r) { rex(false, 0, 0, r); byte(0xFF); modrm(3, 4, r); }
+
+    // guest register r lives at [REG_BASE + r * 2]
+    void load_guest(int dst, int r) { rex(false, dst, 0, REG_BASE); byte(0x0F); byte(0xB7); modrm(1, dst, REG_BASE); byte(r * 2); }
+    void store_guest(int r, int src) { byte(0x66); rex(false, src, 0, REG_BASE); byte(0x89); modrm(1, src, REG_BASE); byte(r * 2); }
+    void store_guest_imm(int r, uint16_t v) { byte(0x66); byte(0xC7); modrm(1, 0, REG_BASE); byte(r * 2); imm16(v); }
+    void load_flag(int dst) { rex(false, dst, 0, REG_BASE); byte(0x0F); byte(0xB7); modrm(1, dst, REG_BASE); byte(flag_disp); }
+    void store_flag(int src) { byte(0x66); rex(false, src, 0, REG_BASE); byte(0x89); modrm(1, src, REG_BASE); byte(flag_disp); }
+    void store_flag_imm(uint16_t v) { byte(0x66); byte(0xC7); modrm(1, 0, REG_BASE); byte(flag_disp); imm16(v); }
+
+    // movzx dst, word [MEMORY + idx * 2]
+    void load_memory(int dst, int idx) {
+        rex(false, dst, idx, MEMORY);
+        byte(0x0F); byte(0xB7);
+        modrm(0, dst, 4);
+        byte((1 << 6) | ((idx & 7) << 3) | (MEMORY & 7));
+    }
+    // movzx dst, word [MEMORY + disp32]
+    void load_memory_at(int dst, uint32_t disp) { rex(false, dst, 0, MEMORY); byte(0x0F); byte(0xB7); modrm(2, dst, MEMORY); imm32(disp); }
+    // test byte [MACHINE + idx + disp32], bits
+    void test_machine_byte(int idx, int32_t disp, uint8_t bits) {
+        rex(false, 0, idx, MACHINE);
+        byte(0xF6);
+        modrm(2, 0, 4);
+        byte(((idx & 7) << 3) | (MACHINE & 7));
+        imm32(disp);
+        byte(bits);
+    }
+    // mov dst, [ENTRIES + idx * 8]
+    void load_entry(int dst, int idx) {
+        rex(true, dst, idx, ENTRIES);
+        byte(0x8B);
+        modrm(0, dst, 4);
+        byte((3 << 6) | ((idx & 7) << 3) | (ENTRIES & 7));
+    }
+
+    // these return where the rel32 is, for patching later
+    uint8_t *jmp() { byte(0xE9); uint8_t *site = p; imm32(0); return site; }
+    uint8_t *jcc(int cc) { byte(0x0F); byte(0x80 + cc); uint8_t *site = p; imm32(0); return site; }
+
+    void call_helper(const void *fn) { mov_imm64(RAX, (uint64_t)fn); call(RAX); }
+};
+
+}
+
+struct LC3_Jit {
+    uint8_t *code;
+    size_t code_used;
+    int64_t (*enter)(jit_context *);
+    uint8_t *exit;
+    size_t runtime_size; // trampoline and exit, kept across flushes
+    int8_t flag_disp;
+    int32_t page_flags_disp; // machine->page_flags relative to MACHINE
+
+    uint8_t *entry[MEMORY_MAX];    // translated block starting at each address
+    uint16_t covered[MEMORY_MAX];  // how many blocks cover each address, so stores can skip the lookup
+    uint8_t heat[MEMORY_MAX];      // backward branches seen to each address
+
+    std::vector<std::unique_ptr<jit_block>> blocks;
+    std::vector<std::unique_ptr<jit_link>> links;
+    std::vector<jit_block *> pages[MEMORY_MAX >> 8]; // blocks touching each 256 word page
+    std::unordered_map<uint16_t, std::vector<jit_link *>> waiting; // links whose target isn't translated
+
+    // set when a store threw a block away, native code checks it after every store
+    bool exit_requested;
+};
+
+namespace {
+
+// helpers called from native code. Everything that can touch memory goes through mem_write so the
+// decode cache and the JIT see the store
+
+int64_t jit_take_exit(LC3_Machine *machine) {
+    bool stale = machine->jit->exit_requested;
+    machine->jit->exit_requested = false;
+    return stale;
+}
+
+int64_t jit_store(LC3_Machine *machine, uint16_t address, uint16_t val) {
+    mem_write(address, val, machine);
+    return jit_take_exit(machine);
+}
+
+int64_t jit_store_indirect(LC3_Machine *machine, uint16_t pointer, uint16_t val) {
+    mem_write(mem_read(pointer, machine), val, machine);
+    return jit_take_exit(machine);
+}
+
+uint16_t jit_load(LC3_Machine *machine, uint16_t address) {
+    return mem_read(address, machine);
+}
+
+void jit_jsr(LC3_Machine *machine, uint16_t return_addr) {
+    push(return_addr, machine);
+    machine->reg[R_R7] = return_addr;
+}
+
+uint16_t jit_jsrr(LC3_Machine *machine, uint16_t return_addr, uint16_t base_r) {
+    jit_jsr(machine, return_addr);
+    return machine->reg[base_r];
+}
+
+uint16_t jit_jmp(LC3_Machine *machine, uint16_t base_r) {
+    if (base_r == R_R7) {
+        pop(machine);
+    }
+    return machine->reg[base_r];
+}
+
+// condition to jump on after testing flag_value, for each nzp mask BR can have (0 and 7 never test)
+const int branch_cc[8] = {0, CC_G, CC_E, CC_NS, CC_S, CC_NE, CC_LE, 0};
+
+bool writes_flags(uint8_t op) {
+    switch (op) {
+        case OP_ADD: case OP_AND: case OP_NOT: case OP_LD: case OP_LDI: case OP_LDR: case OP_LEA:
+            return true;
+    }
+    return false;
+}
+
+// instructions after which native code might stop, so flag_value has to be right by then
+bool may_exit(uint8_t op) {
+    switch (op) {
+        case OP_ST: case OP_STI: case OP_STR: case OP_BR: case OP_JMP: case OP_JSR:
+            return true;
+    }
+    return false;
+}
+
+void build_runtime(LC3_Jit *jit) {
+    emitter e{jit->code, jit->flag_disp};
+
+    // int64_t enter(jit_context *ctx)
+    jit->enter = reinterpret_cast<int64_t (*)(jit_context *)>(e.p);
+    e.push(RBP);
+    e.push(RBX);
+    e.push(R12);
+    e.push(R13);
+    e.push(R14);
+    e.push(R15);
+    e.sub_rsp(FRAME_PAD);
+    e.load64(REG_BASE, ARG0, offsetof(jit_context, reg));
+    e.load64(MACHINE, ARG0, offsetof(jit_context, machine));
+    e.load64(BUDGET, ARG0, offsetof(jit_context, budget));
+    e.load64(ENTRIES, ARG0, offsetof(jit_context, entries));
+    e.load64(MEMORY, ARG0, offsetof(jit_context, memory));
+    e.jmp_mem(ARG0, offsetof(jit_context, code));
+
+    // every way out of native code ends here, with R_PC already stored. Returns the budget left
+    jit->exit = e.p;
+    e.mov64(RAX, BUDGET);
+    e.add_rsp(FRAME_PAD);
+    e.pop(R15);
+    e.pop(R14);
+    e.pop(R13);
+    e.pop(R12);
+    e.pop(RBX);
+    e.pop(RBP);
+    e.ret();
+
+    jit->runtime_size = e.p - jit->code;
+    jit->code_used = jit->runtime_size;
+}
+
+void link_to(LC3_Jit *jit, jit_link *link, jit_block *target) {
+    patch_rel32(link->site, target->code);
+    target->incoming.push_back(link);
+}
+
+void invalidate_block(LC3_Jit *jit, jit_block *block) {
+    block->valid = false;
+    jit->entry[block->start] = nullptr;
+
+    for (uint32_t a = block->start; a <= block->end; a++) {
+        jit->covered[a]--;
+    }
+    for (uint32_t page = block->start >> 8; page <= (uint32_t)(block->end >> 8); page++) {
+        std::vector<jit_block *> &list = jit->pages[page];
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] == block) {
+                list[i] = list.back();
+                list.pop_back();
+                break;
+            }
+        }
+    }
+
+    // anything chained into this block goes back through its stub until the address is translated again
+    for (jit_link *link : block->incoming) {
+        if (link->from->valid) {
+            patch_rel32(link->site, link->stub);
+            jit->waiting[block->start].push_back(link);
+        }
+    }
+    block->incoming.clear();
+}
+
+// guest loads. Only addresses on a PAGE_MMIO or PAGE_WATCH page need mem_read, everything else
+// comes straight out of memory
+void emit_load(emitter &e, int32_t page_flags_disp, int addr_reg, uint8_t *&done_fixup) {
+    e.mov32(RCX, addr_reg);
+    e.shr32(RCX, PAGE_SHIFT);
+    e.test_machine_byte(RCX, page_flags_disp, PAGE_SLOW);
+    uint8_t *slow = e.jcc(CC_NE);
+    e.load_memory(RAX, addr_reg);
+    done_fixup = e.jmp();
+    patch_rel32(slow, e.p);
+    e.mov32(ARG1, addr_reg);
+    e.mov64(ARG0, MACHINE);
+    e.call_helper((const void *)jit_load);
+    e.movzx16(RAX, RAX);
+    patch_rel32(done_fixup, e.p);
+}
+
+// mapping a device or adding a watchpoint flushes everything, so checking the page now is good enough
+void emit_load_at(emitter &e, LC3_Machine *machine, uint16_t address) {
+    if (machine->page_flags[address >> PAGE_SHIFT] & PAGE_SLOW) {
+        e.mov_imm32(ARG1, address);
+        e.mov64(ARG0, MACHINE);
+        e.call_helper((const void *)jit_load);
+        e.movzx16(RAX, RAX);
+    }
+    else {
+        e.load_memory_at(RAX, address * 2);
+    }
+}
+
+// condition codes are lazy (see LC3_Machine::flag_value), so this is just the result in eax
+void emit_flags(emitter &e) {
+    e.store_flag(RAX);
+}
+
+struct pending_stub {
+    uint8_t *site;
+    uint16_t pc;
+    uint32_t refund; // budget to give back for the instructions we didn't run
+};
+
+void compile_block(LC3_Machine *machine, uint16_t start) {
+    LC3_Jit *jit = machine->jit;
+
+    if (jit->code_used + MAX_BLOCK_CODE > CODE_SIZE) {
+        jit_flush(machine);
+    }
+
+    std::vector<lc3_decoded> instrs;
+    uint32_t pc = start;
+
+    while ((int)instrs.size() < MAX_BLOCK_INSTRUCTIONS && pc < MEMORY_MAX &&
+           !(machine->page_flags[pc >> PAGE_SHIFT] & PAGE_MMIO)) {
+        lc3_decoded d = fetch_decoded(pc, machine);
+        // blocks are compiled an instruction at a time, superinstructions are only for the interpreters
+        d.op = base_op(d.op);
+        if (d.op == OP_TRAP || d.op == OP_RTI || d.op == OP_RES || d.op == OP_BREAKPOINT) {
+            break;
+        }
+        instrs.push_back(d);
+        pc++;
+        if (d.op == OP_BR || d.op == OP_JMP || d.op == OP_JSR) {
+            break;
+        }
+    }
+
+    if (instrs.empty()) {
+        jit->heat[start] = HEAT_NEVER;
+        return;
+    }
+
+    int n = instrs.size();
+
+    // flag_value only has to be written by the last flag writer before anything that reads it or
+    // could leave native code
+    std::vector<bool> need_flags(n);
+    bool need = true;
+    for (int i = n - 1; i >= 0; i--) {
+        if (writes_flags(instrs[i].op)) {
+            need_flags[i] = need;
+            need = false;
+        }
+        if (may_exit(instrs[i].op)) {
+            need = true;
+        }
+    }
+
+    jit_block *block = new jit_block;
+    jit->blocks.emplace_back(block);
+    block->start = start;
+    block->end = start + n - 1;
+
+    emitter e{jit->code + jit->code_used, jit->flag_disp};
+    block->code = e.p;
+
+    std::vector<pending_stub> stubs;
+    std::vector<std::pair<uint8_t *, uint16_t>> exits; // chainable jumps and their targets
+
+    e.sub64_imm32(BUDGET, n);
+    stubs.push_back({e.jcc(CC_L), start, (uint32_t)n});
+
+    bool terminated = false;
+
+    for (int i = 0; i < n; i++) {
+        lc3_decoded instr = instrs[i];
+        uint16_t next = start + i + 1;
+        uint8_t *fixup;
+
+        switch (instr.op) {
+            case OP_ADD:
+            case OP_AND:
+                e.load_guest(RAX, instr.sr1);
+                if (instr.imm) {
+                    if (instr.op == OP_ADD) e.add_imm32(RAX, (int16_t)instr.offset);
+                    else e.and_imm32(RAX, (int16_t)instr.offset);
+                }
+                else {
+                    e.load_guest(RCX, instr.sr2);
+                    if (instr.op == OP_ADD) e.add32(RAX, RCX);
+                    else e.and32(RAX, RCX);
+                }
+                e.store_guest(instr.dr, RAX);
+                break;
+
+            case OP_NOT:
+                e.load_guest(RAX, instr.sr1);
+                e.not32(RAX);
+                e.store_guest(instr.dr, RAX);
+                break;
+
+            case OP_LD:
+                emit_load_at(e, machine, next + instr.offset);
+                e.store_guest(instr.dr, RAX);
+                break;
+
+            case OP_LDI:
+                emit_load_at(e, machine, next + instr.offset);
+                emit_load(e, jit->page_flags_disp, RAX, fixup);
+                e.store_guest(instr.dr, RAX);
+                break;
+
+            case OP_LDR:
+                e.load_guest(RAX, instr.sr1);
+                e.add_imm32(RAX, (int16_t)instr.offset);
+                e.movzx16(RAX, RAX);
+                emit_load(e, jit->page_flags_disp, RAX, fixup);
+                e.store_guest(instr.dr, RAX);
+                break;
+
+            case OP_LEA: {
+                uint16_t val = next + instr.offset;
+                e.store_guest_imm(instr.dr, val);
+                if (need_flags[i]) {
+                    e.store_flag_imm(val);
+                }
+                break;
+            }
+
+            case OP_ST:
+            case OP_STI:
+            case OP_STR:
+                if (instr.op == OP_STR) {
+                    e.load_guest(RAX, instr.sr1);
+                    e.add_imm32(RAX, (int16_t)instr.offset);
+                    e.movzx16(ARG1, RAX);
+                }
+                else {
+                    e.mov_imm32(ARG1, (uint16_t)(next + instr.offset));
+                }
+                e.load_guest(ARG2, instr.dr);
+                e.mov64(ARG0, MACHINE);
+                e.call_helper(instr.op == OP_STI ? (const void *)jit_store_indirect : (const void *)jit_store);
+
+                // the store hit translated code, which might be this block
+                e.test32(RAX);
+                stubs.push_back({e.jcc(CC_NE), next, (uint32_t)(n - i - 1)});
+                break;
+
+            case OP_BR: {
+                uint16_t target = next + instr.offset;
+                if (instr.dr == 0x7) {
+                    exits.push_back({e.jmp(), target});
+                }
+                else {
+                    if (instr.dr != 0) {
+                        e.load_flag(RAX);
+                        e.test16(RAX);
+                        exits.push_back({e.jcc(branch_cc[instr.dr]), target});
+                    }
+                    exits.push_back({e.jmp(), next});
+                }
+                terminated = true;
+                break;
+            }
+
+            case OP_JSR:
+                e.mov_imm32(ARG1, next);
+                e.mov64(ARG0, MACHINE);
+                if (instr.imm) {
+                    e.call_helper((const void *)jit_jsr);
+                    exits.push_back({e.jmp(), (uint16_t)(next + instr.offset)});
+                    terminated = true;
+                    break;
+                }
+                e.mov_imm32(ARG2, instr.sr1);
+                e.call_helper((const void *)jit_jsrr);
+                [[fallthrough]];
+
+            case OP_JMP:
+                if (instr.op == OP_JMP) {
+                    e.mov_imm32(ARG1, instr.sr1);
+                    e.mov64(ARG0, MACHINE);
+                    e.call_helper((const void *)jit_jmp);
+                }
+
+                // target only known now, so look it up and go there if it's translated
+                e.store_guest(R_PC, RAX);
+                e.movzx16(RAX, RAX);
+                e.load_entry(RCX, RAX);
+                e.test64(RCX);
+                patch_rel32(e.jcc(CC_E), jit->exit);
+                e.jmp_reg(RCX);
+                terminated = true;
+                break;
+        }
+
+        if (writes_flags(instr.op) && instr.op != OP_LEA && need_flags[i]) {
+            emit_flags(e);
+        }
+    }
+
+    if (!terminated) {
+        exits.push_back({e.jmp(), (uint16_t)(start + n)});
+    }
+
+    // cold paths back to the interpreter
+    for (pending_stub &stub : stubs) {
+        patch_rel32(stub.site, e.p);
+        if (stub.refund) {
+            e.add64_imm32(BUDGET, stub.refund);
+        }
+        e.store_guest_imm(R_PC, stub.pc);
+        patch_rel32(e.jmp(), jit->exit);
+    }
+
+    std::vector<jit_link *> links;
+    for (auto &exit : exits) {
+        jit_link *link = new jit_link{block, exit.first, e.p, exit.second};
+        jit->links.emplace_back(link);
+        links.push_back(link);
+
+        e.store_guest_imm(R_PC, exit.second);
+        patch_rel32(e.jmp(), jit->exit);
+        patch_rel32(link->site, link->stub);
+    }
+
+    jit->code_used = e.p - jit->code;
+
+    // register the block, then chain it both ways
+    jit->entry[start] = block->code;
+    for (uint32_t a = block->start; a <= block->end; a++) {
+        jit->covered[a]++;
+    }
+    for (uint32_t page = block->start >> 8; page <= (uint32_t)(block->end >> 8); page++) {
+        jit->pages[page].push_back(block);
+    }
+
+    for (jit_link *link : links) {
+        uint8_t *target = jit->entry[link->target];
+        if (target) {
+            for (jit_block *b : jit->pages[link->target >> 8]) {
+                if (b->start == link->target) {
+                    link_to(jit, link, b);
+                    break;
+                }
+            }
+        }
+        else {
+            jit->waiting[link->target].push_back(link);
+        }
+    }
+
+    auto it = jit->waiting.find(start);
+    if (it != jit->waiting.end()) {
+        for (jit_link *link : it->second) {
+            if (link->from->valid) {
+                link_to(jit, link, block);
+            }
+        }
+        jit->waiting.erase(it);
+    }
+}
+
+}
+
+bool jit_attach(LC3_Machine *machine) {
+    if (machine->jit) {
+        return true;
+    }
+
+#ifdef _WIN32
+    void *code = VirtualAlloc(nullptr, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    if (!code) {
+        return false;
+    }
+#else
+    void *code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return false;
+    }
+#endif
+
+    LC3_Jit *jit = new LC3_Jit;
+    jit->code = static_cast<uint8_t *>(code);
+    jit->flag_disp = reinterpret_cast<uint8_t *>(&machine->flag_value) - reinterpret_cast<uint8_t *>(machine->reg);
+    jit->page_flags_disp = reinterpret_cast<uint8_t *>(machine->page_flags) - reinterpret_cast<uint8_t *>(machine);
+    std::memset(jit->entry, 0, sizeof(jit->entry));
+    std::memset(jit->covered, 0, sizeof(jit->covered));
+    std::memset(jit->heat, 0, sizeof(jit->heat));
+    jit->exit_requested = false;
+    build_runtime(jit);
+
+    machine->jit = jit;
+    return true;
+}
+
+void jit_detach(LC3_Machine *machine) {
+    LC3_Jit *jit = machine->jit;
+    if (!jit) {
+        return;
+    }
+
+#ifdef _WIN32
+    VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+    munmap(jit->code, CODE_SIZE);
+#endif
+    delete jit;
+    machine->jit = nullptr;
+}
+
+uint64_t jit_backedge(LC3_Machine *machine, uint64_t budget) {
+    LC3_Jit *jit = machine->jit;
+    uint16_t pc = machine->reg[R_PC];
+
+    if (!jit->entry[pc]) {
+        if (jit->heat[pc] == HEAT_NEVER || ++jit->heat[pc] < JIT_THRESHOLD) {
+            return 0;
+        }
+        // native code would spin on it, the interpreters know to wait for a key instead
+        if (kbsr_poll_loop(pc, machine)) {
+            jit->heat[pc] = HEAT_NEVER;
+            return 0;
+        }
+        compile_block(machine, pc);
+        if (!jit->entry[pc]) {
+            return 0;
+        }
+    }
+
+    // never more than the interpreter has left, run_for's budget holds with the JIT too
+    int64_t entry_budget = (int64_t)std::min<uint64_t>(budget, ENTRY_BUDGET);
+
+    jit->exit_requested = false;
+    jit_context ctx{machine->reg, machine, entry_budget, jit->entry, machine->memory, jit->entry[pc]};
+    int64_t left = (int64_t)jit->enter(&ctx);
+
+    return entry_budget - left;
+}
+
+void jit_invalidate(uint16_t address, LC3_Machine *machine) {
+    LC3_Jit *jit = machine->jit;
+    if (!jit->covered[address]) {
+        return;
+    }
+
+    std::vector<jit_block *> &list = jit->pages[address >> 8];
+    for (size_t i = 0; i < list.size();) {
+        jit_block *block = list[i];
+        if (block->start <= address && address <= block->end) {
+            // removes it from list, so don't step past the slot
+            invalidate_block(jit, block);
+        }
+        else {
+            i++;
+        }
+    }
+    jit->heat[address] = 0;
+    jit->exit_requested = true;
+}
+
+void jit_flush(LC3_Machine *machine) {
+    LC3_Jit *jit = machine->jit;
+    if (!jit) {
+        return;
+    }
+
+    // only ever called from the interpreter, so no native code is running out of the buffer
+    std::memset(jit->entry, 0, sizeof(jit->entry));
+    std::memset(jit->covered, 0, sizeof(jit->covered));
+    std::memset(jit->heat, 0, sizeof(jit->heat));
+    jit->blocks.clear();
+    jit->links.clear();
+    jit->waiting.clear();
+    for (std::vector<jit_block *> &list : jit->pages) {
+        list.clear();
+    }
+    jit->code_used = jit->runtime_size;
+}
+
+#else
+
+// no native backend for this host, the interpreter keeps running everything
+
+bool jit_attach(LC3_Machine *) { return false; }
+void jit_detach(LC3_Machine *) {}
+uint64_t jit_backedge(LC3_Machine *, uint64_t) { return 0; }
+void jit_invalidate(uint16_t, LC3_Machine *) {}
+void jit_flush(LC3_Machine *) {}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LC3_JIT_H
+#define LC3_JIT_H
+
+#include <cstdint>
+
+#include "lc3.h"
+
+// Basic block JIT to x86-64. run_loop counts taken backward branches per target address, and once
+// a target crosses the threshold the block starting there (up to and including the next BR/JMP/JSR,
+// or up to the next TRAP) is translated to native code. Blocks jump straight into each other when
+// their targets are translated too, and a store into a block throws that block away.
+
+// attaches a JIT to the machine, returns false if this host can't run one (not x86-64)
+bool jit_attach(LC3_Machine *machine);
+
+void jit_detach(LC3_Machine *machine);
+
+// called by the interpreter right after taking a backward branch. Counts the branch, translates the
+// target once it's hot, and runs native code from reg[R_PC] if there is any, at most budget
+// instructions of it. Returns how many instructions ran natively (0 if we stayed in the interpreter)
+uint64_t jit_backedge(LC3_Machine *machine, uint64_t budget);
+
+// throws away every translated block that covers address
+void jit_invalidate(uint16_t address, LC3_Machine *machine);
+
+// throws away every translated block
+void jit_flush(LC3_Machine *machine);
+
+#endif
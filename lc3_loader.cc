@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_loader.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LC3_SWAP_SSE2 1
+#endif
+
+namespace {
+
+// read only view of a whole file, unmapped when it goes out of scope
+struct mapped_file {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    explicit mapped_file(const std::string &path);
+    ~mapped_file();
+};
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::string &path) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Invalid File provided: " + path);
+    }
+
+    LARGE_INTEGER length;
+    GetFileSizeEx(file, &length);
+    size = length.QuadPart;
+    if (size == 0) {
+        return;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data = mapping ? static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (!data) {
+        throw std::runtime_error("Couldn't map " + path);
+    }
+}
+
+mapped_file::~mapped_file() {
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+}
+
+#else
+
+mapped_file::mapped_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        // out of descriptors or memory, nothing wrong with the file itself
+        if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
+            throw std::runtime_error("Couldn't open " + path + ": " + std::strerror(errno));
+        }
+        throw std::runtime_error("Invalid File provided: " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Invalid File provided: " + path);
+    }
+    size = st.st_size;
+
+    if (size > 0) {
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error("Couldn't map " + path + ": " + std::strerror(error));
+        }
+        data = static_cast<const unsigned char *>(p);
+    }
+    // the mapping stays valid without the descriptor
+    close(fd);
+}
+
+mapped_file::~mapped_file() {
+    if (data) munmap(const_cast<unsigned char *>(data), size);
+}
+
+#endif
+
+std::string hex(uint32_t value) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "x%04X", value);
+    return buf;
+}
+
+}
+
+void swap_words(uint16_t *dest, const unsigned char *src, size_t count) {
+    size_t i = 0;
+
+#ifdef LC3_SWAP_SSE2
+    // 8 words at a time, the file offset is odd (after the origin word) as far as alignment goes
+    // so both sides are unaligned loads/stores
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), v);
+    }
+#endif
+
+    for (; i < count; i++) {
+        dest[i] = (uint16_t)((src[2 * i] << 8) | src[2 * i + 1]);
+    }
+}
+
+void load_image(const std::string &path, LC3_Machine *machine, image_load &report) {
+    mapped_file file{path};
+
+    if (file.size < 2) {
+        throw std::runtime_error("Image has no origin: " + path);
+    }
+
+    uint16_t origin;
+    swap_words(&origin, file.data, 1);
+
+    size_t words = (file.size - 2) / 2;
+    if (file.size % 2) {
+        report.warnings.push_back(path + ": odd byte at the end ignored");
+    }
+
+    // nothing wraps around to x0000, whatever doesn't fit is dropped
+    if (words > (size_t)(MEMORY_MAX - origin)) {
+        report.warnings.push_back(path + ": " + std::to_string(words - (MEMORY_MAX - origin)) +
+                                  " words past xFFFF dropped (origin " + hex(origin) + ")");
+        words = MEMORY_MAX - origin;
+    }
+
+    uint32_t end = origin + words;
+    for (const image_segment &other : report.segments) {
+        uint32_t other_end = other.origin + other.words;
+        if (words && other.words && origin < other_end && other.origin < end) {
+            report.warnings.push_back(path + " overwrites " + other.file + " at " +
+                                      hex(std::max<uint32_t>(origin, other.origin)) + "-" +
+                                      hex(std::min(end, other_end) - 1));
+        }
+    }
+
+    swap_words(machine->memory + origin, file.data + 2, words);
+    // so restoring a snapshot taken before the load puts these pages back
+    for (uint32_t address = origin; address < end; address += PAGE_SIZE) {
+        mark_dirty(address, machine);
+    }
+    if (words) {
+        mark_dirty(end - 1, machine);
+    }
+    report.segments.push_back({path, origin, (uint32_t)words});
+}
+
+image_load load_images(const std::vector<std::string> &paths, LC3_Machine *machine) {
+    image_load report;
+
+    for (const std::string &path : paths) {
+        load_image(path, machine, report);
+    }
+    clear_decoded(machine);
+    return report;
+}
+
+void init_registers(LC3_Machine *machine) {
+    // since exactly one condition flag should be set at any given time, set the Z flag
+    set_flags(FL_ZRO, machine);
+
+    machine->reg[R_R6] = STACK_START;
+    machine->reg[R_PC] = PC_START;
+}
@@ -0,0 +1,44 @@
+#ifndef LC3_LOADER_H
+#define LC3_LOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+
+enum { PC_START = 0x3000 };
+enum { STACK_START = 0xFD00 };
+
+// Object files are an origin word followed by the words that go there, all big endian. The file is
+// mapped and swapped straight into memory in one pass, and several of them can go into one machine.
+
+// one file's worth of memory
+struct image_segment {
+    std::string file;
+    uint16_t origin;
+    uint32_t words; // how many actually made it into memory
+};
+
+struct image_load {
+    std::vector<image_segment> segments;
+    // things that loaded, but probably not the way whoever built the images meant: segments running
+    // past xFFFF, an odd byte at the end of a file, segments landing on top of each other
+    std::vector<std::string> warnings;
+};
+
+// big endian words in src to host order in dest
+void swap_words(uint16_t *dest, const unsigned char *src, size_t count);
+
+// adds one file to memory, and to report. Throws if it can't be read or doesn't even have an origin.
+// Doesn't touch the decode cache, see load_images
+void load_image(const std::string &path, LC3_Machine *machine, image_load &report);
+
+// loads every file in order (later ones win where they overlap), then resets the decode cache
+image_load load_images(const std::vector<std::string> &paths, LC3_Machine *machine);
+
+// registers the way a program expects them on entry: Z set, R6 on the stack, PC at PC_START
+void init_registers(LC3_Machine *machine);
+
+#endif
@@ -0,0 +1,204 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_jit.h"
+#include "lc3_bus.h"
+#include "lc3_memory.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#endif
+
+namespace {
+
+// memory first, then the decode cache. Both are whole OS pages so they can share one mapping
+const size_t MEMORY_BYTES = MEMORY_MAX * sizeof(uint16_t);
+const size_t IMAGE_BYTES = MEMORY_BYTES + MEMORY_MAX * sizeof(lc3_decoded);
+
+}
+
+// the backing store, a file that only lives in memory
+struct LC3_Image {
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    LC3_Image();
+    LC3_Image(const LC3_Image &) = delete;
+    LC3_Image &operator=(const LC3_Image &) = delete;
+    ~LC3_Image();
+
+    // writable shared view, only used while filling the image in
+    void *map_shared() const;
+    void *map_private() const;
+};
+
+namespace {
+
+void unmap(void *view) {
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, IMAGE_BYTES);
+#endif
+}
+
+void fill_blank(void *view) {
+    uint16_t *memory = static_cast<uint16_t *>(view);
+    lc3_decoded *decoded = reinterpret_cast<lc3_decoded *>(memory + MEMORY_MAX);
+
+    std::memset(memory, 0, MEMORY_BYTES);
+    for (int i = 0; i < MEMORY_MAX; i++) {
+        decoded[i] = lc3_decoded();
+    }
+}
+
+// what every machine starts on, made once and never freed
+const LC3_Image &blank_image() {
+    static const LC3_Image *blank = [] {
+        LC3_Image *image = new LC3_Image;
+        void *view = image->map_shared();
+        fill_blank(view);
+        unmap(view);
+        return image;
+    }();
+    return *blank;
+}
+
+}
+
+#ifdef _WIN32
+
+LC3_Image::LC3_Image() {
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, IMAGE_BYTES, nullptr);
+    if (!mapping) {
+        throw std::runtime_error("Couldn't create a memory image");
+    }
+}
+
+LC3_Image::~LC3_Image() {
+    CloseHandle(mapping);
+}
+
+void *LC3_Image::map_shared() const {
+    void *view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, IMAGE_BYTES);
+    if (!view) {
+        throw std::runtime_error("Couldn't map a memory image");
+    }
+    return view;
+}
+
+void *LC3_Image::map_private() const {
+    void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, IMAGE_BYTES);
+    if (!view) {
+        throw std::runtime_error("Couldn't map a memory image");
+    }
+    return view;
+}
+
+#else
+
+LC3_Image::LC3_Image() {
+#ifdef __linux__
+    fd = memfd_create("lc3-image", MFD_CLOEXEC);
+#else
+    // no memfd, a shared memory object that's unlinked straight away does the same
+    char name[64];
+    snprintf(name, sizeof(name), "/lc3-image-%d-%p", (int)getpid(), (void *)this);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+#endif
+    if (fd < 0 || ftruncate(fd, IMAGE_BYTES) != 0) {
+        // out of descriptors (EMFILE) or memory, say which
+        int error = errno;
+        if (fd >= 0) close(fd);
+        throw std::runtime_error(std::string("Couldn't create a memory image: ") + std::strerror(error));
+    }
+}
+
+LC3_Image::~LC3_Image() {
+    close(fd);
+}
+
+void *LC3_Image::map_shared() const {
+    void *view = mmap(nullptr, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) {
+        throw std::runtime_error(std::string("Couldn't map a memory image: ") + std::strerror(errno));
+    }
+    return view;
+}
+
+void *LC3_Image::map_private() const {
+    void *view = mmap(nullptr, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        throw std::runtime_error(std::string("Couldn't map a memory image: ") + std::strerror(errno));
+    }
+    return view;
+}
+
+#endif
+
+LC3_Machine::LC3_Machine() {
+    memory = nullptr;
+    decoded = nullptr;
+    map_image(this, blank_image());
+
+    map_device(this, MR_KBSR, MR_KBDR, keyboard_device());
+    map_device(this, MR_DSR, MR_DDR, display_device());
+}
+
+LC3_Machine::~LC3_Machine() {
+    jit_detach(this);
+    unmap(memory);
+}
+
+std::shared_ptr<LC3_Image> share_image(LC3_Machine *machine) {
+    auto image = std::make_shared<LC3_Image>();
+    void *view = image->map_shared();
+
+    uint16_t *memory = static_cast<uint16_t *>(view);
+    lc3_decoded *decoded = reinterpret_cast<lc3_decoded *>(memory + MEMORY_MAX);
+
+    std::memcpy(memory, machine->memory, MEMORY_BYTES);
+    for (int i = 0; i < MEMORY_MAX; i++) {
+        // device registers stay undecoded, same as fetch_decoded
+        decoded[i] = machine->page_flags[i >> PAGE_SHIFT] & PAGE_MMIO ? lc3_decoded() : decode(memory[i]);
+    }
+    // superinstructions as well, map_image takes apart the ones running into a machine's breakpoints
+    for (int i = 0; i < MEMORY_MAX; i++) {
+        decoded[i].op = fuse(decoded[i], decoded[(uint16_t)(i + 1)], decoded[(uint16_t)(i + 2)]);
+    }
+
+    unmap(view);
+    return image;
+}
+
+void map_image(LC3_Machine *machine, const LC3_Image &image) {
+    void *view = image.map_private();
+
+    if (machine->memory) {
+        unmap(machine->memory);
+    }
+    machine->memory = static_cast<uint16_t *>(view);
+    machine->decoded = reinterpret_cast<lc3_decoded *>(machine->memory + MEMORY_MAX);
+
+    // every page is different now as far as snapshots and translated code are concerned
+    machine->dirty_since = 0;
+    jit_flush(machine);
+    mark_breakpoints(machine);
+}
@@ -0,0 +1,24 @@
+#ifndef LC3_MEMORY_H
+#define LC3_MEMORY_H
+
+#include <memory>
+
+#include "lc3.h"
+
+// Guest memory and the decode cache live in an LC3_Image, and machines map it copy-on-write: every
+// machine on the same image shares its pages, and a page is only copied (by the OS) the first time
+// one machine writes to it. A fresh machine maps the blank image (all zero, nothing decoded), so it
+// costs next to nothing until it's loaded into. To run many copies of a program, load it into one
+// machine, share_image that, and map_image the result into the rest.
+
+struct LC3_Image;
+
+// freezes machine's current memory into an image other machines can map. Everything below the
+// device registers gets decoded up front so the machines sharing it don't each decode the same code
+std::shared_ptr<LC3_Image> share_image(LC3_Machine *machine);
+
+// replaces machine's memory and decode cache with a private view of image. The machine doesn't keep
+// the image alive, the view stays valid on its own
+void map_image(LC3_Machine *machine, const LC3_Image &image);
+
+#endif
@@ -0,0 +1,144 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lc3_output.h"
+
+namespace {
+
+typedef std::chrono::steady_clock output_clock;
+
+void writer_loop();
+
+struct output_pipeline {
+    std::mutex lock;
+    std::condition_variable wake;    // the writer sleeps on this
+    std::condition_variable drained; // output_flush sleeps on this
+
+    std::string current;             // the buffer the VM is filling
+    output_clock::time_point current_since;
+    std::deque<std::string> queue;   // buffers handed to the writer, oldest first
+    std::vector<std::string> spare;  // written buffers, reused so we don't allocate each time
+    bool writing = false;
+    bool stop = false;
+
+    size_t flush_bytes = 64 << 10;
+    std::chrono::milliseconds flush_ms{50};
+
+    std::thread writer;
+
+    // runs at exit, so nothing the guest printed gets lost
+    ~output_pipeline() {
+        if (!writer.joinable()) return;
+
+        output_flush();
+        {
+            std::lock_guard<std::mutex> guard{lock};
+            stop = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+};
+
+output_pipeline out;
+
+// lock must be held
+void hand_over() {
+    if (out.current.empty()) return;
+
+    out.queue.push_back(std::move(out.current));
+    if (!out.spare.empty()) {
+        out.current = std::move(out.spare.back());
+        out.spare.pop_back();
+    }
+    else {
+        out.current = std::string();
+        out.current.reserve(out.flush_bytes);
+    }
+    out.wake.notify_one();
+}
+
+void writer_loop() {
+    std::unique_lock<std::mutex> guard{out.lock};
+
+    while (true) {
+        // a partly filled buffer goes out on its own once it has waited long enough
+        if (out.queue.empty() && !out.current.empty()) {
+            output_clock::time_point due = out.current_since + out.flush_ms;
+            if (output_clock::now() < due) {
+                out.wake.wait_until(guard, due);
+                continue;
+            }
+            hand_over();
+        }
+
+        if (out.queue.empty()) {
+            if (out.stop) return;
+
+            out.drained.notify_all();
+            out.wake.wait(guard);
+            continue;
+        }
+
+        std::string buf = std::move(out.queue.front());
+        out.queue.pop_front();
+        out.writing = true;
+
+        guard.unlock();
+        std::fwrite(buf.data(), 1, buf.size(), stdout);
+        std::fflush(stdout);
+        guard.lock();
+
+        out.writing = false;
+        buf.clear();
+        out.spare.push_back(std::move(buf));
+    }
+}
+
+}
+
+void output_put(char c) {
+    output_write(&c, 1);
+}
+
+void output_write(const char *data, size_t n) {
+    std::lock_guard<std::mutex> guard{out.lock};
+
+    if (!out.writer.joinable()) {
+        out.writer = std::thread(writer_loop);
+    }
+
+    // first byte of a new buffer, start its clock and let the writer know
+    if (out.current.empty()) {
+        out.current_since = output_clock::now();
+        out.wake.notify_one();
+    }
+
+    out.current.append(data, n);
+
+    if (out.current.size() >= out.flush_bytes) {
+        hand_over();
+    }
+}
+
+void output_flush() {
+    std::unique_lock<std::mutex> guard{out.lock};
+
+    if (!out.writer.joinable()) return;
+
+    hand_over();
+    out.drained.wait(guard, [] { return out.queue.empty() && !out.writing; });
+}
+
+void output_configure(size_t flush_bytes, unsigned flush_ms) {
+    std::lock_guard<std::mutex> guard{out.lock};
+
+    out.flush_bytes = flush_bytes;
+    out.flush_ms = std::chrono::milliseconds{flush_ms};
+}
@@ -0,0 +1,21 @@
+#ifndef LC3_OUTPUT_H
+#define LC3_OUTPUT_H
+
+#include <cstddef>
+
+// Guest output. The trap routines append to a buffer here instead of writing to std::cout, and full
+// buffers are written to stdout by a background thread so the VM never waits on the terminal.
+// Queued output reaches stdout once its buffer fills up, once it has waited flush_ms, or on output_flush
+
+void output_put(char c);
+
+void output_write(const char *data, size_t n);
+
+// everything queued so far is on stdout once this returns. Called before reading input, on halt,
+// and before anything else writes to std::cout
+void output_flush();
+
+// hand a buffer to the writer once it holds flush_bytes, or once its oldest byte is flush_ms old
+void output_configure(size_t flush_bytes, unsigned flush_ms);
+
+#endif
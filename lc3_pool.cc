@@ -0,0 +1,124 @@
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "lc3_pool.h"
+
+namespace {
+
+// which pool and deque the current thread works for, so submits from inside a task stay local
+thread_local const Work_Pool *current_pool = nullptr;
+thread_local unsigned current_index = 0;
+
+}
+
+Work_Pool::Work_Pool(unsigned threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    for (unsigned i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<worker_queue>());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(&Work_Pool::worker_loop, this, i);
+    }
+}
+
+Work_Pool::~Work_Pool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+
+    for (std::thread &t : workers) {
+        t.join();
+    }
+}
+
+unsigned Work_Pool::size() const {
+    return queues.size();
+}
+
+void Work_Pool::submit(std::function<void()> task) {
+    unsigned index;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        index = current_pool == this ? current_index : next_queue++ % queues.size();
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        // counted only once it's in the deque, a woken worker always finds something to take
+        std::lock_guard<std::mutex> guard(state_lock);
+        queued++;
+    }
+    work_ready.notify_one();
+}
+
+void Work_Pool::wait() {
+    std::unique_lock<std::mutex> guard(state_lock);
+    all_done.wait(guard, [this] { return pending == 0; });
+}
+
+bool Work_Pool::take(unsigned index, std::function<void()> &task) {
+    // own deque from the back
+    {
+        worker_queue &own = *queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // everyone else's from the front, starting with the next one over so thieves spread out
+    for (unsigned i = 1; i < queues.size(); i++) {
+        worker_queue &victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Work_Pool::worker_loop(unsigned index) {
+    current_pool = this;
+    current_index = index;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            work_ready.wait(guard, [this] { return queued > 0 || stopping; });
+            if (queued == 0) {
+                return;
+            }
+            // claim one, whichever deque it ends up coming from
+            queued--;
+        }
+
+        std::function<void()> task;
+        while (!take(index, task)) {
+            // another worker got to the one we claimed first, so the one it claimed is still out there
+            std::this_thread::yield();
+        }
+        task();
+
+        std::lock_guard<std::mutex> guard(state_lock);
+        if (--pending == 0) {
+            all_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef LC3_POOL_H
+#define LC3_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with a task deque each. A worker takes from the back of its own deque
+// (newest first, still warm in cache) and once that's empty steals from the front of the others, so a
+// few long tasks don't leave the rest of the workers idle behind them.
+class Work_Pool {
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> workers;
+
+    // guards the counters below, workers sleep on work_ready when every deque is empty
+    std::mutex state_lock;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+    size_t queued = 0;  // sitting in a deque
+    size_t pending = 0; // submitted and not finished yet
+    bool stopping = false;
+
+    unsigned next_queue = 0; // round robin for submits from outside the pool
+
+    void worker_loop(unsigned index);
+    bool take(unsigned index, std::function<void()> &task);
+
+    public:
+        // threads = 0 means one per core
+        explicit Work_Pool(unsigned threads = 0);
+
+        // waits for everything submitted, then stops the workers
+        ~Work_Pool();
+
+        // from a worker the task goes on that worker's own deque, otherwise they're dealt out in turn
+        void submit(std::function<void()> task);
+
+        // returns once every submitted task has finished
+        void wait();
+
+        unsigned size() const;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_profile.h"
+
+namespace {
+
+const char *const OP_NAMES[16] = {
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
+
+std::string hex(uint16_t value) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "x%04X", value);
+    return buf;
+}
+
+// "3004", "x3004" or "0x3004"
+bool parse_address(std::string text, uint16_t &address) {
+    if (text.rfind("0x", 0) == 0 || text.rfind("0X", 0) == 0) {
+        text = text.substr(2);
+    }
+    else if (text[0] == 'x' || text[0] == 'X') {
+        text = text.substr(1);
+    }
+    if (text.empty() || text.size() > 4 || text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        return false;
+    }
+    address = std::stoul(text, nullptr, 16);
+    return true;
+}
+
+double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0;
+}
+
+// control can leave straight line code after these
+bool ends_block(uint16_t bits) {
+    uint8_t op = bits >> 12;
+    return op == OP_BR || op == OP_JMP || op == OP_JSR || op == OP_TRAP || op == OP_RTI;
+}
+
+// goes through the call tree depth first, enter(node) on the way down and leave(node) on the way up.
+// No recursion, guest recursion can make the tree as deep as it likes
+template <typename Enter, typename Leave>
+void walk_calls(const run_profile &profile, Enter enter, Leave leave) {
+    std::vector<std::vector<uint32_t>> children(profile.calls.size());
+    for (uint32_t node = 1; node < profile.calls.size(); node++) {
+        children[profile.calls[node].parent].push_back(node);
+    }
+
+    // node, and how many of its children are done
+    std::vector<std::pair<uint32_t, size_t>> stack{{0, 0}};
+    enter(0);
+
+    while (!stack.empty()) {
+        uint32_t node = stack.back().first;
+        size_t next = stack.back().second++;
+
+        if (next < children[node].size()) {
+            enter(children[node][next]);
+            stack.push_back({children[node][next], 0});
+        }
+        else {
+            leave(node);
+            stack.pop_back();
+        }
+    }
+}
+
+}
+
+symbol_table load_symbols(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Couldn't open symbol table " + path);
+    }
+
+    symbol_table symbols;
+    std::string line;
+    while (std::getline(in, line)) {
+        // lc3as comments out every line of its table
+        size_t start = line.find_first_not_of("/ \t");
+        if (start == std::string::npos) {
+            continue;
+        }
+
+        std::istringstream fields(line.substr(start));
+        std::string name, value;
+        uint16_t address;
+        if (fields >> name >> value && parse_address(value, address)) {
+            symbols.push_back({address, name});
+        }
+    }
+
+    std::stable_sort(symbols.begin(), symbols.end(), [](const lc3_symbol &a, const lc3_symbol &b) {
+        return a.address < b.address;
+    });
+    return symbols;
+}
+
+std::string symbolize(uint16_t address, const symbol_table &symbols) {
+    auto after = std::upper_bound(symbols.begin(), symbols.end(), address, [](uint16_t a, const lc3_symbol &s) {
+        return a < s.address;
+    });
+    if (after == symbols.begin()) {
+        return hex(address);
+    }
+
+    const lc3_symbol &symbol = *(after - 1);
+    if (symbol.address == address) {
+        return symbol.name;
+    }
+    return symbol.name + "+" + std::to_string(address - symbol.address);
+}
+
+std::vector<profile_block> hot_blocks(const run_profile &profile, const LC3_Machine *machine) {
+    std::vector<profile_block> blocks;
+    bool open = false;
+
+    for (int address = 0; address < MEMORY_MAX; address++) {
+        uint64_t count = profile.pcs[address];
+        if (count == 0) {
+            open = false;
+            continue;
+        }
+
+        if (!open || count != blocks.back().runs) {
+            blocks.push_back({(uint16_t)address, (uint16_t)address, count, 0});
+        }
+        blocks.back().end = address;
+        blocks.back().instructions += count;
+        open = !ends_block(machine->memory[address]);
+    }
+
+    std::stable_sort(blocks.begin(), blocks.end(), [](const profile_block &a, const profile_block &b) {
+        return a.instructions > b.instructions;
+    });
+    return blocks;
+}
+
+std::vector<routine_profile> routine_totals(const run_profile &profile) {
+    const std::vector<call_node> &calls = profile.calls;
+
+    // children always come after their parent
+    std::vector<uint64_t> inclusive(calls.size());
+    for (size_t node = calls.size(); node-- > 0;) {
+        inclusive[node] += profile.self(node);
+        if (node != 0) {
+            inclusive[calls[node].parent] += inclusive[node];
+        }
+    }
+
+    std::vector<routine_profile> by_address(MEMORY_MAX);
+    std::vector<uint32_t> active(MEMORY_MAX); // times each routine is on the stack we're walking
+
+    walk_calls(profile,
+        [&](uint32_t node) {
+            if (node == 0) {
+                return;
+            }
+            routine_profile &r = by_address[calls[node].routine];
+            r.calls += calls[node].calls;
+            r.exclusive += profile.self(node);
+            // a call further up already has this one's instructions
+            if (active[calls[node].routine]++ == 0) {
+                r.inclusive += inclusive[node];
+            }
+        },
+        [&](uint32_t node) {
+            if (node != 0) {
+                active[calls[node].routine]--;
+            }
+        });
+
+    std::vector<routine_profile> routines;
+    for (int address = 0; address < MEMORY_MAX; address++) {
+        if (by_address[address].calls) {
+            by_address[address].routine = address;
+            routines.push_back(by_address[address]);
+        }
+    }
+    std::stable_sort(routines.begin(), routines.end(), [](const routine_profile &a, const routine_profile &b) {
+        return a.inclusive > b.inclusive;
+    });
+    return routines;
+}
+
+void write_folded(std::ostream &out, const run_profile &profile, const symbol_table &symbols) {
+    std::string stack;
+    std::vector<size_t> lengths;
+
+    walk_calls(profile,
+        [&](uint32_t node) {
+            lengths.push_back(stack.size());
+            stack += node == 0 ? "main" : ";" + symbolize(profile.calls[node].routine, symbols);
+            if (uint64_t self = profile.self(node)) {
+                out << stack << ' ' << self << '\n';
+            }
+        },
+        [&](uint32_t) {
+            stack.resize(lengths.back());
+            lengths.pop_back();
+        });
+}
+
+void write_profile(std::ostream &out, const run_profile &profile, const LC3_Machine *machine,
+                   const symbol_table &symbols, size_t top) {
+    char line[160];
+    uint64_t total = profile.instructions();
+    out << "instructions " << total << "\n\n";
+
+    out << "opcodes\n";
+    for (int op = 0; op < 16; op++) {
+        if (profile.ops[op]) {
+            snprintf(line, sizeof(line), "  %-5s %14llu %6.2f%%\n", OP_NAMES[op],
+                     (unsigned long long)profile.ops[op], percent(profile.ops[op], total));
+            out << line;
+        }
+    }
+
+    std::vector<uint16_t> addresses;
+    std::vector<uint16_t> branches;
+    for (int address = 0; address < MEMORY_MAX; address++) {
+        if (profile.pcs[address]) {
+            addresses.push_back(address);
+        }
+        if (profile.taken[address] || profile.not_taken[address]) {
+            branches.push_back(address);
+        }
+    }
+
+    // sorting only as much as gets shown
+    auto hottest = [top](std::vector<uint16_t> &list, auto count) {
+        size_t n = std::min(top, list.size());
+        std::partial_sort(list.begin(), list.begin() + n, list.end(), [&count](uint16_t a, uint16_t b) {
+            return count(a) > count(b) || (count(a) == count(b) && a < b);
+        });
+        list.resize(n);
+    };
+
+    hottest(addresses, [&profile](uint16_t a) { return profile.pcs[a]; });
+    out << "\nhot addresses\n";
+    for (uint16_t address : addresses) {
+        snprintf(line, sizeof(line), "  %s %-24s %-5s %14llu %6.2f%%\n", hex(address).c_str(),
+                 symbolize(address, symbols).c_str(), OP_NAMES[machine->memory[address] >> 12],
+                 (unsigned long long)profile.pcs[address], percent(profile.pcs[address], total));
+        out << line;
+    }
+
+    std::vector<profile_block> blocks = hot_blocks(profile, machine);
+    out << "\nhot blocks\n";
+    for (size_t i = 0; i < std::min(top, blocks.size()); i++) {
+        const profile_block &b = blocks[i];
+        std::string range = hex(b.start) + "-" + hex(b.end);
+        snprintf(line, sizeof(line), "  %-11s %-24s %3d instrs %14llu runs %14llu %6.2f%%\n", range.c_str(),
+                 symbolize(b.start, symbols).c_str(), b.end - b.start + 1, (unsigned long long)b.runs,
+                 (unsigned long long)b.instructions, percent(b.instructions, total));
+        out << line;
+    }
+
+    hottest(branches, [&profile](uint16_t a) { return profile.taken[a] + profile.not_taken[a]; });
+    out << "\nbranches\n";
+    for (uint16_t address : branches) {
+        uint64_t taken = profile.taken[address], not_taken = profile.not_taken[address];
+        snprintf(line, sizeof(line), "  %s %-24s %14llu taken %14llu not taken %6.2f%% taken\n",
+                 hex(address).c_str(), symbolize(address, symbols).c_str(), (unsigned long long)taken,
+                 (unsigned long long)not_taken, percent(taken, taken + not_taken));
+        out << line;
+    }
+
+    std::vector<routine_profile> routines = routine_totals(profile);
+    out << "\nroutines\n";
+    for (size_t i = 0; i < std::min(top, routines.size()); i++) {
+        const routine_profile &r = routines[i];
+        snprintf(line, sizeof(line), "  %s %-24s %12llu calls %14llu inclusive %6.2f%% %14llu exclusive %6.2f%%\n",
+                 hex(r.routine).c_str(), symbolize(r.routine, symbols).c_str(), (unsigned long long)r.calls,
+                 (unsigned long long)r.inclusive, percent(r.inclusive, total),
+                 (unsigned long long)r.exclusive, percent(r.exclusive, total));
+        out << line;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef LC3_PROFILE_H
+#define LC3_PROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+
+// Reports on what a run with RUN_PROFILE counted (run_profile in lc3_run.h), for finding where a
+// guest spends its time. Addresses are shown against a symbol table when there is one.
+
+struct lc3_symbol {
+    uint16_t address;
+    std::string name;
+};
+
+// sorted by address
+typedef std::vector<lc3_symbol> symbol_table;
+
+// reads the symbol file an assembler wrote next to the object file: lines with a name and a hex
+// address, the way lc3as writes them ("//	LOOP             3004") or plain ("LOOP x3004"). Anything
+// else in the file is skipped. Throws if it can't be opened
+symbol_table load_symbols(const std::string &path);
+
+// "LOOP+2" for the closest symbol at or before address, "x3006" if there isn't one
+std::string symbolize(uint16_t address, const symbol_table &symbols);
+
+// straight line code the profile saw run: start..end always ran together, runs times
+struct profile_block {
+    uint16_t start;
+    uint16_t end;
+    uint64_t runs;
+    uint64_t instructions; // runs * length, what it cost
+};
+
+// blocks from the per address counts, hottest first. A block ends after a BR/JMP/JSR/TRAP and
+// wherever the count changes, which is where something jumped in or out. Code is read from machine
+std::vector<profile_block> hot_blocks(const run_profile &profile, const LC3_Machine *machine);
+
+// totals for one routine over the whole call tree
+struct routine_profile {
+    uint16_t routine;
+    uint64_t calls;
+    uint64_t inclusive; // instructions run in it and in everything it called, recursion counted once
+    uint64_t exclusive; // only in it
+};
+
+// every routine that was called, most inclusive first
+std::vector<routine_profile> routine_totals(const run_profile &profile);
+
+// the call tree as folded stacks, what flamegraph.pl and the like read: one line per chain of calls
+// that ran anything, "main;PARSE;GETNUM 1234", with the instructions run in the last routine
+void write_folded(std::ostream &out, const run_profile &profile, const symbol_table &symbols);
+
+// opcodes, then the top hottest addresses, blocks, branches and routines
+void write_profile(std::ostream &out, const run_profile &profile, const LC3_Machine *machine,
+                   const symbol_table &symbols, size_t top = 20);
+
+#endif
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_replay.h"
+
+bool Record_IO::replaying() {
+    while (index < log.size() && used == log[index].count) {
+        index++;
+        used = 0;
+    }
+    return index < log.size();
+}
+
+int Record_IO::take(uint8_t kind) {
+    const io_event &e = log[index];
+    if (e.kind != kind) {
+        throw std::runtime_error("Replay log doesn't match what the program asked for");
+    }
+    used++;
+    return e.value;
+}
+
+void Record_IO::append(uint8_t kind, int value) {
+    if (log.empty() || log.back().kind != kind || log.back().value != value) {
+        log.push_back({kind, (int16_t)value, 0});
+    }
+    log.back().count++;
+
+    index = log.size() - 1;
+    used = log.back().count;
+}
+
+uint16_t Record_IO::check_key() {
+    if (replaying()) {
+        return take(EV_CHECK_KEY);
+    }
+    uint16_t key = live->check_key();
+    append(EV_CHECK_KEY, key);
+    return key;
+}
+
+int Record_IO::read_key() {
+    if (replaying()) {
+        return take(EV_READ_KEY);
+    }
+    int c = live->read_key();
+    append(EV_READ_KEY, c);
+    return c;
+}
+
+bool Record_IO::input_ended() {
+    if (replaying()) {
+        return take(EV_INPUT_ENDED);
+    }
+    bool ended = live->input_ended();
+    append(EV_INPUT_ENDED, ended);
+    return ended;
+}
+
+void Record_IO::wait_key() {
+    // the log already knows when the key came
+    if (!replaying()) {
+        live->wait_key();
+    }
+}
+
+void Record_IO::write(const char *data, size_t n) {
+    size_t skip = shown > written ? std::min<uint64_t>(n, shown - written) : 0;
+    written += n;
+    shown = std::max(shown, written);
+
+    if (skip < n) {
+        live->write(data + skip, n - skip);
+    }
+}
+
+void save_log(const std::string &path, const std::vector<io_event> &log) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Couldn't write replay log " + path);
+    }
+    for (const io_event &e : log) {
+        out << (int)e.kind << ' ' << e.value << ' ' << e.count << '\n';
+    }
+}
+
+std::vector<io_event> load_log(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Couldn't open replay log " + path);
+    }
+
+    std::vector<io_event> log;
+    int kind, value;
+    uint32_t count;
+    while (in >> kind >> value >> count) {
+        if (kind < EV_CHECK_KEY || kind > EV_INPUT_ENDED || count == 0) {
+            throw std::runtime_error("Bad replay log " + path);
+        }
+        log.push_back({(uint8_t)kind, (int16_t)value, count});
+    }
+    return log;
+}
+
+namespace {
+
+// newer ends up with older's pages too, wherever it doesn't have its own
+void fold(const replay_checkpoint &older, replay_checkpoint &newer) {
+    std::vector<uint8_t> pages;
+    std::vector<uint16_t> words;
+    size_t a = 0, b = 0;
+
+    while (a < older.pages.size() || b < newer.pages.size()) {
+        bool from_newer = b < newer.pages.size() && (a == older.pages.size() || newer.pages[b] <= older.pages[a]);
+        const replay_checkpoint &from = from_newer ? newer : older;
+        size_t k = from_newer ? b : a;
+
+        pages.push_back(from.pages[k]);
+        words.insert(words.end(), from.words.begin() + k * PAGE_SIZE, from.words.begin() + (k + 1) * PAGE_SIZE);
+
+        if (from_newer) {
+            if (a < older.pages.size() && older.pages[a] == newer.pages[b]) a++;
+            b++;
+        }
+        else {
+            a++;
+        }
+    }
+    newer.pages = std::move(pages);
+    newer.words = std::move(words);
+}
+
+}
+
+LC3_Recorder::LC3_Recorder(LC3_Machine *machine, uint64_t interval, size_t max_checkpoints)
+    : machine(machine), old_io(machine->io), recorded(machine->io), interval(interval),
+      max_checkpoints(std::max<size_t>(max_checkpoints, 2)) {
+    machine->io = &recorded;
+    checkpoint();
+}
+
+LC3_Recorder::~LC3_Recorder() {
+    machine->io = old_io;
+}
+
+void LC3_Recorder::checkpoint() {
+    replay_checkpoint cp;
+    cp.executed = count;
+    std::memcpy(cp.reg, machine->reg, sizeof(cp.reg));
+    cp.flag_value = machine->flag_value;
+    cp.frames = machine->frames;
+    cp.depth = machine->depth;
+    cp.untracked = machine->untracked;
+    cp.index = recorded.index;
+    cp.used = recorded.used;
+    cp.written = recorded.written;
+
+    bool first = newest.empty();
+    if (first) {
+        newest.resize(MEMORY_MAX);
+    }
+
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        const uint16_t *now = machine->memory + (page << PAGE_SHIFT);
+        uint16_t *before = newest.data() + (page << PAGE_SHIFT);
+
+        if (first || std::memcmp(now, before, PAGE_SIZE * sizeof(uint16_t)) != 0) {
+            cp.pages.push_back(page);
+            cp.words.insert(cp.words.end(), now, now + PAGE_SIZE);
+            std::memcpy(before, now, PAGE_SIZE * sizeof(uint16_t));
+        }
+    }
+
+    checkpoints.push_back(std::move(cp));
+    if (checkpoints.size() > max_checkpoints) {
+        thin();
+    }
+}
+
+void LC3_Recorder::thin() {
+    // keeps the first (every page) and the newest (matches newest), drops every other one in between
+    std::vector<replay_checkpoint> kept;
+    kept.push_back(std::move(checkpoints[0]));
+
+    for (size_t i = 1; i < checkpoints.size(); i += 2) {
+        if (i + 1 < checkpoints.size()) {
+            fold(checkpoints[i], checkpoints[i + 1]);
+            kept.push_back(std::move(checkpoints[i + 1]));
+        }
+        else {
+            kept.push_back(std::move(checkpoints[i]));
+        }
+    }
+    checkpoints = std::move(kept);
+    interval *= 2;
+}
+
+void LC3_Recorder::restore(size_t i) {
+    // each page comes from the newest checkpoint up to i that has it, the first one has them all
+    const uint16_t *source[PAGE_COUNT] = {};
+    for (size_t c = 0; c <= i; c++) {
+        for (size_t k = 0; k < checkpoints[c].pages.size(); k++) {
+            source[checkpoints[c].pages[k]] = checkpoints[c].words.data() + k * PAGE_SIZE;
+        }
+    }
+
+    // only words that differ, same as restore_snapshot
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        uint16_t *memory = machine->memory + (page << PAGE_SHIFT);
+        bool changed = false;
+
+        for (int w = 0; w < PAGE_SIZE; w++) {
+            if (memory[w] != source[page][w]) {
+                memory[w] = source[page][w];
+                invalidate_decoded((page << PAGE_SHIFT) + w, machine);
+                changed = true;
+            }
+        }
+        if (changed) {
+            mark_dirty(page << PAGE_SHIFT, machine);
+        }
+    }
+
+    const replay_checkpoint &cp = checkpoints[i];
+    std::memcpy(machine->reg, cp.reg, sizeof(machine->reg));
+    machine->flag_value = cp.flag_value;
+    machine->frames = cp.frames;
+    machine->depth = cp.depth;
+    machine->untracked = cp.untracked;
+    recorded.index = cp.index;
+    recorded.used = cp.used;
+    recorded.written = cp.written;
+    count = cp.executed;
+}
+
+run_result LC3_Recorder::run(uint64_t budget, unsigned features) {
+    uint64_t done = 0;
+
+    while (true) {
+        // never run past the next checkpoint that's due
+        uint64_t due = checkpoints.back().executed + interval;
+        uint64_t chunk = std::min(budget - done, due - count);
+
+        // the threaded engine stops at breakpoints by itself, anything else needs the interpreter
+        run_result result = features == RUN_BREAKPOINTS ?
+            run_for(machine, chunk) :
+            run_interpreter(machine, chunk, features);
+        count += result.executed;
+        done += result.executed;
+
+        if (count == due) {
+            checkpoint();
+        }
+        if (result.reason != EXIT_BUDGET || done == budget) {
+            return {result.reason, result.pc, done};
+        }
+
+        // the next call won't check the instruction it starts on
+        if ((features & RUN_BREAKPOINTS) && breakpoint_at(machine->reg[R_PC], machine)) {
+            return {EXIT_BREAKPOINT, machine->reg[R_PC], done};
+        }
+    }
+}
+
+void LC3_Recorder::seek(uint64_t target) {
+    size_t i = checkpoints.size() - 1;
+    while (checkpoints[i].executed > target) {
+        i--;
+    }
+
+    // already between that checkpoint and target, no need to go back
+    if (count > target || count < checkpoints[i].executed) {
+        restore(i);
+    }
+    run(target - count, 0);
+}
+
+bool LC3_Recorder::reverse_step() {
+    if (count == 0) {
+        return false;
+    }
+    seek(count - 1);
+    return true;
+}
+
+run_result LC3_Recorder::reverse_continue(unsigned features) {
+    uint64_t now = count;
+
+    // newest stretch between checkpoints first, the last stop in it is the one we want
+    for (size_t i = checkpoints.size(); i-- > 0;) {
+        uint64_t from = checkpoints[i].executed;
+        if (from >= now) {
+            continue;
+        }
+        uint64_t to = i + 1 < checkpoints.size() ? std::min(checkpoints[i + 1].executed, now) : now;
+
+        restore(i);
+        uint64_t last = UINT64_MAX;
+        run_exit reason = EXIT_BUDGET;
+
+        if ((features & RUN_BREAKPOINTS) && breakpoint_at(machine->reg[R_PC], machine)) {
+            last = from;
+            reason = EXIT_BREAKPOINT;
+        }
+        while (count < to) {
+            run_result result = run(to - count, features);
+            if ((result.reason == EXIT_BREAKPOINT || result.reason == EXIT_WATCHPOINT) && count < now) {
+                last = count;
+                reason = result.reason;
+            }
+            else if (result.reason != EXIT_BUDGET) {
+                break;
+            }
+        }
+
+        if (last != UINT64_MAX) {
+            seek(last);
+            return {reason, machine->reg[R_PC], 0};
+        }
+    }
+
+    seek(0);
+    return {EXIT_BUDGET, machine->reg[R_PC], 0};
+}
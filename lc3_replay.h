@@ -0,0 +1,127 @@
+#ifndef LC3_REPLAY_H
+#define LC3_REPLAY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_io.h"
+#include "lc3_run.h"
+
+// Record and replay. Everything a guest can't predict (KBSR polls, GETC/IN keys, whether input has
+// ended) comes through LC3_IO, so logging what those calls returned is enough to run the program
+// again exactly the same way. LC3_Recorder adds checkpoints on top of that for running backwards.
+
+enum {
+    EV_CHECK_KEY,
+    EV_READ_KEY,
+    EV_INPUT_ENDED
+};
+
+// count calls in a row that all returned value
+struct io_event {
+    uint8_t kind;
+    int16_t value;
+    uint32_t count;
+};
+
+// hands out what's in log while there's any left, then goes to live and appends what it says.
+// Output only reaches live the first time through, replaying it again is quiet
+struct Record_IO : LC3_IO {
+    LC3_IO *live;
+    std::vector<io_event> log;
+
+    // next call to replay: log[index] has been used count times so far
+    size_t index = 0;
+    uint32_t used = 0;
+
+    uint64_t written = 0; // output bytes the guest has produced on this run through
+    uint64_t shown = 0;   // and the most it ever got to, everything before that was already shown
+
+    explicit Record_IO(LC3_IO *live) : live(live) {}
+
+    uint16_t check_key() override;
+    int read_key() override;
+    bool input_ended() override;
+    void wait_key() override;
+    void write(const char *data, size_t n) override;
+    void flush() override { live->flush(); }
+
+    // true while calls are answered from the log
+    bool replaying();
+
+    private:
+        int take(uint8_t kind);
+        void append(uint8_t kind, int value);
+};
+
+// one event per line, "<kind> <value> <count>". Throw if the file can't be written or read
+void save_log(const std::string &path, const std::vector<io_event> &log);
+std::vector<io_event> load_log(const std::string &path);
+
+// machine state every so often while recording. The first one has every page, the rest only the
+// pages that changed since the one before
+struct replay_checkpoint {
+    uint64_t executed; // instructions run when it was taken
+
+    uint16_t reg[R_COUNT];
+    uint16_t flag_value;
+    std::vector<uint16_t> frames;
+    uint16_t depth;
+    uint64_t untracked;
+
+    // Record_IO position
+    size_t index;
+    uint32_t used;
+    uint64_t written;
+
+    std::vector<uint8_t> pages;   // page numbers, ascending
+    std::vector<uint16_t> words;  // PAGE_SIZE words for each of them
+};
+
+// Records a machine so it can go back. Checkpoints are taken every interval instructions; once there
+// are more than max_checkpoints, every other one is folded into the next and the interval doubles,
+// so memory stays bounded however long it runs. Going back restores the closest checkpoint before the
+// target and runs forward from it, with input coming out of the log.
+class LC3_Recorder {
+    LC3_Machine *machine;
+    LC3_IO *old_io;
+    Record_IO recorded;
+
+    uint64_t interval;
+    size_t max_checkpoints;
+    uint64_t count = 0; // instructions run since recording started
+    std::vector<replay_checkpoint> checkpoints;
+    std::vector<uint16_t> newest; // memory as of checkpoints.back()
+
+    void checkpoint();
+    void thin();
+    void restore(size_t i);
+
+    public:
+        // swaps machine->io for a Record_IO around it, until the recorder goes away
+        explicit LC3_Recorder(LC3_Machine *machine, uint64_t interval = 1000000, size_t max_checkpoints = 64);
+        LC3_Recorder(const LC3_Recorder &) = delete;
+        LC3_Recorder &operator=(const LC3_Recorder &) = delete;
+        ~LC3_Recorder();
+
+        // like run_interpreter, taking checkpoints on the way. With only RUN_BREAKPOINTS it runs on the
+        // threaded engine instead
+        run_result run(uint64_t budget, unsigned features);
+
+        // puts the machine back to where it was after target instructions, target <= executed()
+        void seek(uint64_t target);
+
+        // one instruction back, false if we're at the start
+        bool reverse_step();
+
+        // back to the last place before now that run with features would have stopped at
+        // (EXIT_BREAKPOINT or EXIT_WATCHPOINT), or to the start (EXIT_BUDGET) if there isn't one
+        run_result reverse_continue(unsigned features);
+
+        uint64_t executed() const { return count; }
+        Record_IO &io() { return recorded; }
+};
+
+#endif
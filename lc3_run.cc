@@ -1,368 +1,555 @@
 #include <iostream>
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <utility>
 #include <bitset>
 #include <signal.h>
-#include <Windows.h>
-#include <conio.h>
 #include <stdexcept>
+#include <string>
 
 #include "lc3.h"
 #include "lc3_run.h"
-
-HANDLE hStdin = INVALID_HANDLE_VALUE;
-DWORD fdwMode, fdwOldMode;
-
-void disable_input_buffering() {
-    hStdin = GetStdHandle(STD_INPUT_HANDLE);
-    GetConsoleMode(hStdin, &fdwOldMode); /* save old mode */
-    fdwMode = fdwOldMode
-            ^ ENABLE_ECHO_INPUT  /* no input echo */
-            ^ ENABLE_LINE_INPUT; /* return when one or
-                                    more characters are available */
-    SetConsoleMode(hStdin, fdwMode); /* set new mode */
-    FlushConsoleInputBuffer(hStdin); /* clear buffer */
-}
-
-void restore_input_buffering() {
-    SetConsoleMode(hStdin, fdwOldMode);
-}
-
-uint16_t check_key() {
-    return WaitForSingleObject(hStdin, 1000) == WAIT_OBJECT_0 && _kbhit();
-}
-
-void handle_interrupt(int signal) {
-    restore_input_buffering();
-    printf("\n");
-    exit(-2);
-}
+#include "lc3_jit.h"
+#include "lc3_bus.h"
+#include "lc3_watch.h"
 
 void mem_write(uint16_t address, uint16_t val, LC3_Machine *machine)
 {
+    if (uint8_t flags = machine->page_flags[address >> PAGE_SHIFT])
+    {
+        if (flags & PAGE_WATCH)
+        {
+            watch_write(address, val, machine);
+        }
+        if (flags & PAGE_MMIO)
+        {
+            bus_write(address, val, machine);
+            return;
+        }
+    }
     machine->memory[address] = val;
+    mark_dirty(address, machine);
+    invalidate_decoded(address, machine);
 }
 
 uint16_t mem_read(uint16_t address, LC3_Machine *machine)
 {
-    if (address == MR_KBSR)
+    if (uint8_t flags = machine->page_flags[address >> PAGE_SHIFT])
     {
-        if (check_key())
+        if (flags & PAGE_WATCH)
         {
-            machine->memory[MR_KBSR] = (1 << 15);
-            machine->memory[MR_KBDR] = getchar();
+            watch_read(address, machine);
         }
-        else
+        if (flags & PAGE_MMIO)
         {
-            machine->memory[MR_KBSR] = 0;
+            return bus_read(address, machine);
         }
     }
     return machine->memory[address];
 }
 
-int run_loop(LC3_Machine *machine, bool debug) {
-    /* FETCH */
-    uint16_t *reg = machine->reg;
-    lc3_instruction instr{mem_read(machine->reg[R_PC]++, machine)}; // this is fine because we're R_PC doesn't mean anything. The actual R_PC address is what's in the registry
-    uint16_t op = instr.opcode();
+uint16_t fetch_word(uint16_t address, LC3_Machine *machine)
+{
+    if (machine->page_flags[address >> PAGE_SHIFT] & PAGE_MMIO)
+    {
+        return bus_read(address, machine);
+    }
+    return machine->memory[address];
+}
 
+namespace {
 
-    switch (op) {
-        case OP_ADD: {
-            if (debug) {
-                std::cout << "Executing operation: ADD\n";
-            }
-            if (instr.is_imm()) {
-                reg[instr.dr()] = reg[instr.sr1()] + instr.imm5();
-            }
-            else {
-                reg[instr.dr()] = reg[instr.sr1()] + reg[instr.sr2()];
-            }
-            update_flags(instr.dr(), machine);
-            break;
-        }
+// the decode cache entry at address without looking for superinstructions, filled in if it's plain
+// memory. Device registers come back OP_UNDECODED
+lc3_decoded peek_decoded(uint16_t address, LC3_Machine *machine) {
+    lc3_decoded &d = machine->decoded[address];
 
-        case OP_AND: {
-            if (debug) {
-                std::cout << "Executing operation: AND\n";
-            }
-            if (instr.is_imm()) {
-                reg[instr.dr()] = reg[instr.sr1()] & instr.imm5();
-            }
-            else {
-                reg[instr.dr()] = reg[instr.sr1()] & reg[instr.sr2()];
-            }
-            update_flags(instr.dr(), machine);
-            break;
+    if (d.op == OP_UNDECODED && !(machine->page_flags[address >> PAGE_SHIFT] & PAGE_MMIO)) {
+        d = decode(machine->memory[address]);
+        if (breakpoint_at(address, machine)) {
+            d.op = OP_BREAKPOINT;
         }
+    }
+    return d;
+}
 
-        case OP_NOT: {
-            if (debug) {
-                std::cout << "Executing operation: NOT\n";
-            }
-            reg[instr.dr()] = ~reg[instr.sr1()];
-            update_flags(instr.dr(), machine);
-            break;
+// superinstructions read the two entries after their own, so whatever changes address takes apart
+// the ones starting right before it. They get fused again the next time they're fetched
+void unfuse_before(uint16_t address, LC3_Machine *machine) {
+    for (uint16_t before = address - 2; before != address; before++) {
+        if (machine->decoded[before].op >= OP_ADD_BR) {
+            machine->decoded[before].op = OP_UNDECODED;
         }
+    }
+}
 
-        case OP_BR: {
-            if (debug) {
-                std::cout << "Executing operation: BR\n";
-            }
-            uint16_t p = (instr.bits() >> 9) & 0x7;
-            if (p & reg[R_COND]) {
-                reg[R_PC] += instr.pc_offset9();
-            }
-            break;
+}
+
+lc3_decoded fetch_decoded(uint16_t address, LC3_Machine *machine) {
+    lc3_decoded &d = machine->decoded[address];
+
+    if (d.op != OP_UNDECODED) {
+        return d;
+    }
+
+    // device registers change under us, so those are never cached
+    bool mmio = machine->page_flags[address >> PAGE_SHIFT] & PAGE_MMIO;
+    lc3_decoded fresh = decode(fetch_word(address, machine));
+
+    if (mmio) {
+        return fresh;
+    }
+    d = fresh;
+
+    // the store that threw the old entry away took the breakpoint with it
+    if (breakpoint_at(address, machine)) {
+        d.op = OP_BREAKPOINT;
+    }
+    else if (fresh.op == OP_ADD || fresh.op == OP_LDR || fresh.op == OP_AND || fresh.op == OP_NOT) {
+        d.op = fuse(fresh, peek_decoded(address + 1, machine), peek_decoded(address + 2, machine));
+    }
+    return d;
+}
+
+void invalidate_decoded(uint16_t address, LC3_Machine *machine) {
+    // only write when there's something to throw away, the decode cache is copy-on-write and
+    // stores to data shouldn't give a machine its own copy of it
+    if (machine->decoded[address].op != OP_UNDECODED) {
+        machine->decoded[address].op = OP_UNDECODED;
+        unfuse_before(address, machine);
+    }
+
+    if (machine->jit) {
+        jit_invalidate(address, machine);
+    }
+}
+
+void clear_decoded(LC3_Machine *machine) {
+    for (int i = 0; i < MEMORY_MAX; i++) {
+        if (machine->decoded[i].op != OP_UNDECODED) {
+            machine->decoded[i].op = OP_UNDECODED;
         }
+    }
+    jit_flush(machine);
+}
 
-        case OP_JMP: {
-            if (debug) {
-                std::cout << "Executing operation: JMP\n";
-            }
+void set_breakpoint(uint16_t address, LC3_Machine *machine) {
+    if (machine->breakpoints.empty()) {
+        machine->breakpoints.resize(MEMORY_MAX / 64);
+    }
+    machine->breakpoints[address >> 6] |= 1ull << (address & 63);
+    machine->decoded[address].op = OP_BREAKPOINT;
+    unfuse_before(address, machine);
 
-            if (instr.base_r() == 0x7) {
-                uint16_t addr = pop(machine);
-                // set PC to addr
-            }
+    // translated blocks would run straight through it
+    if (machine->jit) {
+        jit_invalidate(address, machine);
+    }
+}
+
+void clear_breakpoint(uint16_t address, LC3_Machine *machine) {
+    if (!breakpoint_at(address, machine)) {
+        return;
+    }
+    machine->breakpoints[address >> 6] &= ~(1ull << (address & 63));
+    machine->decoded[address].op = OP_UNDECODED;
+}
 
-            reg[R_PC] = reg[instr.base_r()];
-            break;
+void mark_breakpoints(LC3_Machine *machine) {
+    for (size_t i = 0; i < machine->breakpoints.size(); i++) {
+        for (uint64_t bits = machine->breakpoints[i]; bits; bits &= bits - 1) {
+            uint16_t address = i * 64 + std::countr_zero(bits);
+            machine->decoded[address].op = OP_BREAKPOINT;
+            unfuse_before(address, machine);
         }
+    }
+}
 
-        case OP_JSR: {
-            if (debug) {
-                std::cout << "Executing operation: JSR\n";
-            }
+bool kbsr_poll_loop(uint16_t head, LC3_Machine *machine) {
+    lc3_decoded load = fetch_decoded(head, machine);
+    lc3_decoded branch = fetch_decoded(head + 1, machine);
 
-            if (machine->depth > 0) {
-                // function called inside of functio, so we save the counter on top of stack
-                push(machine->counter, machine);
-                machine->counter = 0;
-            }
+    if (load.op != OP_LDI || machine->memory[(uint16_t)(head + 1 + load.offset)] != MR_KBSR) {
+        return false;
+    }
+    // KBSR is 0 (Z) until a key comes in and x8000 (N) after, so it has to loop on Z and stop on N
+    return branch.op == OP_BR && branch.offset == 0xFFFE && (branch.dr & FL_ZRO) && !(branch.dr & FL_NEG);
+}
 
-            machine->depth++;
+bool kbsr_idle(uint16_t head, LC3_Machine *machine) {
+    return kbsr_poll_loop(head, machine) && !machine->io->check_key() && !machine->io->input_ended();
+}
 
-            push(reg[R_PC], machine);
-            reg[R_R7] = reg[R_PC];
-            if (instr.is_jsr()) {
-                reg[R_PC] += instr.pc_offset11();
-            }
-            else {
-                reg[R_PC] = reg[instr.base_r()];
+namespace {
+
+// compile time version of the RUN_* bits, interpret is instantiated once per combination so the
+// checks for features that are off aren't there at all
+template <unsigned FEATURES>
+struct run_policy {
+    static constexpr bool trace = FEATURES & RUN_TRACE;
+    static constexpr bool profile = FEATURES & RUN_PROFILE;
+    static constexpr bool breakpoints = FEATURES & RUN_BREAKPOINTS;
+    static constexpr bool watch = FEATURES & RUN_WATCH;
+    // the JIT runs whole blocks natively, which would skip the per instruction work
+    static constexpr bool jit = !trace && !profile && !breakpoints && !watch;
+    // superinstructions too, except breakpoints are fine since fuse never reaches over one
+    static constexpr bool fuse = !trace && !profile && !watch;
+};
+
+template <typename P>
+inline void trace(const char *name) {
+    if constexpr (P::trace) {
+        std::cout << "Executing operation: " << name << '\n';
+    }
+}
+
+template <typename P>
+run_result interpret(LC3_Machine *machine, uint64_t budget) {
+    uint16_t *reg = machine->reg;
+    uint64_t executed = 0;
+
+    // anything from before this run (the debugger looking at memory) doesn't count
+    if constexpr (P::watch) {
+        machine->hit.kind = 0;
+    }
+
+    while (executed < budget) {
+        /* FETCH */
+        lc3_decoded instr = fetch_decoded(reg[R_PC]++, machine);
+        executed++;
+
+        // stop here, unless it's the first instruction, that's how we continue from a breakpoint
+        if (instr.op == OP_BREAKPOINT) {
+            if (P::breakpoints && executed != 1) {
+                reg[R_PC]--;
+                return {EXIT_BREAKPOINT, reg[R_PC], executed - 1};
             }
-            break;
+            instr = decode(fetch_word(reg[R_PC] - 1, machine));
         }
 
-        case OP_LD: {
-            if (debug) {
-                std::cout << "Executing operation: LD\n";
-            }
-            reg[instr.dr()] = mem_read(reg[R_PC] + instr.pc_offset9(), machine);
-            update_flags(instr.dr(), machine);
-            break;
+        // a superinstruction runs as one only if the budget has room for all of it, otherwise (or if
+        // something wants to see every instruction) it's just its first instruction
+        if (instr.op >= OP_ADD_BR && (!P::fuse || budget - executed < (uint64_t)fused_length(instr.op) - 1)) {
+            instr.op = base_op(instr.op);
         }
 
-        case OP_LDI: {
-            if (debug) {
-                std::cout << "Executing operation: LDI\n";
-            }
-            reg[instr.dr()] = mem_read(mem_read(reg[R_PC] + instr.pc_offset9(), machine), machine);
-            update_flags(instr.dr(), machine);
-            break;
+        if constexpr (P::profile) {
+            machine->profile->ops[instr.op]++;
+            machine->profile->pcs[(uint16_t)(reg[R_PC] - 1)]++;
         }
 
-        case OP_LDR: {
-            if (debug) {
-                std::cout << "Executing operation: LDR\n";
+        switch (instr.op) {
+            case OP_ADD: {
+                trace<P>("ADD");
+                if (instr.imm) {
+                    reg[instr.dr] = reg[instr.sr1] + instr.offset;
+                }
+                else {
+                    reg[instr.dr] = reg[instr.sr1] + reg[instr.sr2];
+                }
+                update_flags(instr.dr, machine);
+                break;
             }
-            reg[instr.dr()] = mem_read(reg[instr.base_r()] + instr.offset6(), machine);
-            update_flags(instr.dr(), machine);
-            break;
-        }
 
-        case OP_LEA: {
-            if (debug) {
-                std::cout << "Executing operation: LEA\n";
+            case OP_AND: {
+                trace<P>("AND");
+                if (instr.imm) {
+                    reg[instr.dr] = reg[instr.sr1] & instr.offset;
+                }
+                else {
+                    reg[instr.dr] = reg[instr.sr1] & reg[instr.sr2];
+                }
+                update_flags(instr.dr, machine);
+                break;
             }
-            reg[instr.dr()] = reg[R_PC] + instr.pc_offset9();
-            update_flags(instr.dr(), machine);
-            break;
-        }
 
-        case OP_ST: {
-            if (debug) {
-                std::cout << "Executing operation: ST\n";
+            case OP_NOT: {
+                trace<P>("NOT");
+                reg[instr.dr] = ~reg[instr.sr1];
+                update_flags(instr.dr, machine);
+                break;
             }
 
-            if (machine->depth > 0) {
-                push(reg[instr.dr()], machine);
+            case OP_BR:
+            branch: {
+                trace<P>("BR");
+                bool taken = instr.dr & get_flags(machine);
+                if constexpr (P::profile) {
+                    (taken ? machine->profile->taken : machine->profile->not_taken)[(uint16_t)(reg[R_PC] - 1)]++;
+                }
+                if (taken) {
+                    reg[R_PC] += instr.offset;
+
+                    // waiting on the keyboard, sleep until there's something to see instead of spinning
+                    if (instr.offset == 0xFFFE && kbsr_idle(reg[R_PC], machine)) {
+                        machine->io->wait_key();
+                    }
+                    // backward branch, the JIT counts these and takes over once the loop is hot
+                    else if (P::jit && machine->jit && (instr.offset >> 15)) {
+                        executed += jit_backedge(machine, budget - executed);
+                    }
+                }
+                break;
             }
 
-            mem_write(reg[R_PC] + instr.pc_offset9(), reg[instr.dr()], machine);
-            break;
-        }
+            case OP_JMP: {
+                trace<P>("JMP");
+                if (instr.sr1 == 0x7) {
+                    pop(machine);
+                    if constexpr (P::profile) {
+                        machine->profile->leave();
+                    }
+                }
+                reg[R_PC] = reg[instr.sr1];
+                break;
+            }
 
-        case OP_STI: {
-            if (debug) {
-                std::cout << "Executing operation: STI\n";
+            case OP_JSR: {
+                trace<P>("JSR");
+                push(reg[R_PC], machine);
+                reg[R_R7] = reg[R_PC];
+                if (instr.imm) {
+                    reg[R_PC] += instr.offset;
+                }
+                else {
+                    reg[R_PC] = reg[instr.sr1];
+                }
+                if constexpr (P::profile) {
+                    machine->profile->enter(reg[R_PC]);
+                }
+                break;
             }
 
-            if (machine->depth > 0) {
-                push(reg[instr.dr()], machine);
+            case OP_LD: {
+                trace<P>("LD");
+                reg[instr.dr] = mem_read(reg[R_PC] + instr.offset, machine);
+                update_flags(instr.dr, machine);
+                break;
             }
 
-            mem_write(mem_read(reg[R_PC] + instr.pc_offset9(), machine), reg[instr.dr()], machine);
-            break;
-        }
-                
-        case OP_STR: {
-            if (debug) {
-                std::cout << "Executing operation: STR\n";
+            case OP_LDI: {
+                trace<P>("LDI");
+                reg[instr.dr] = mem_read(mem_read(reg[R_PC] + instr.offset, machine), machine);
+                update_flags(instr.dr, machine);
+                break;
             }
 
-            if (machine->depth > 0) {
-                push(reg[instr.dr()], machine);
+            case OP_LDR: {
+                trace<P>("LDR");
+                reg[instr.dr] = mem_read(reg[instr.sr1] + instr.offset, machine);
+                update_flags(instr.dr, machine);
+                break;
             }
 
-            mem_write(reg[instr.base_r()] + instr.offset6(), reg[instr.dr()], machine);
-            break;
-        }
+            case OP_LEA: {
+                trace<P>("LEA");
+                reg[instr.dr] = reg[R_PC] + instr.offset;
+                update_flags(instr.dr, machine);
+                break;
+            }
 
-        case OP_TRAP: {
-            reg[R_R7] = reg[R_PC];
-            switch (instr.bits() & 0xFF) {
-                case TRAP_GETC: {
-                    char c;
+            case OP_ST: {
+                trace<P>("ST");
+                mem_write(reg[R_PC] + instr.offset, reg[instr.dr], machine);
+                break;
+            }
 
-                    std::cin >> c;
-                    // while (!(std::cin >> c)) {
-                    //     std::cerr << "Invalid input\n";
-                    //     std::cin.clear();
-                    //     std::cin.ignore();
-                    // }
+            case OP_STI: {
+                trace<P>("STI");
+                mem_write(mem_read(reg[R_PC] + instr.offset, machine), reg[instr.dr], machine);
+                break;
+            }
 
-                    reg[R_R0] = (uint16_t)c;
-                    update_flags(R_R0, machine);
+            case OP_STR: {
+                trace<P>("STR");
+                mem_write(reg[instr.sr1] + instr.offset, reg[instr.dr], machine);
+                break;
+            }
 
-                    break;
-                }
+            // superinstructions, the instructions after the first come from the decode cache
+            case OP_ADD_BR: {
+                reg[instr.dr] = reg[instr.sr1] + (instr.imm ? instr.offset : reg[instr.sr2]);
+                update_flags(instr.dr, machine);
+                instr = machine->decoded[reg[R_PC]++];
+                executed++;
+                goto branch;
+            }
 
-                case TRAP_OUT: {
-                    std::cout << (char)reg[R_R0];
-                    break;
-                }
+            case OP_LDR_ADD_STR: {
+                lc3_decoded add = machine->decoded[reg[R_PC]];
+                lc3_decoded str = machine->decoded[(uint16_t)(reg[R_PC] + 1)];
+                // the ADD sets the flags over the LDR's anyway
+                reg[instr.dr] = mem_read(reg[instr.sr1] + instr.offset, machine);
+                reg[add.dr] = reg[add.sr1] + (add.imm ? add.offset : reg[add.sr2]);
+                update_flags(add.dr, machine);
+                reg[R_PC] += 2;
+                executed += 2;
+                mem_write(reg[str.sr1] + str.offset, reg[str.dr], machine);
+                break;
+            }
 
-                case TRAP_PUTS: {
-                    uint16_t *c = machine->memory + reg[R_R0];
+            case OP_LOAD_IMM: {
+                reg[instr.dr] = machine->decoded[reg[R_PC]++].offset;
+                update_flags(instr.dr, machine);
+                executed++;
+                break;
+            }
 
-                    while (*c != 0x0000) {
-                        char curr = *c;
+            case OP_NEGATE: {
+                reg[instr.dr] = -reg[instr.sr1];
+                update_flags(instr.dr, machine);
+                reg[R_PC]++;
+                executed++;
+                break;
+            }
 
-                        std::cout << curr;
-                        c++;
+            case OP_TRAP: {
+                reg[R_R7] = reg[R_PC];
+                uint64_t calls = machine->depth + machine->untracked;
+                if (!run_trap(instr.offset, machine)) {
+                    return {EXIT_HALTED, reg[R_PC], executed};
+                }
+                // a guest routine got called, its RET will leave() so it needs a node of its own
+                if constexpr (P::profile) {
+                    if (machine->depth + machine->untracked > calls) {
+                        machine->profile->enter(reg[R_PC]);
                     }
-
-                    break;
                 }
+                break;
+            }
 
-                case TRAP_IN: {
-                    std::cout << "Enter a character" << std::endl;
-                    char c;
-
-                    std::cin >> c;
-                    // while (!(std::cin >> c)) {
-                    //     std::cerr << "Invalid input" << std::endl;
-                    //     std::cin.clear();
-                    //     std::cin.ignore();
-                    // }
-                    std::cout << c << '\n';
-                    reg[R_R0] = (uint16_t)c;
-                    update_flags(R_R0, machine);
-
-                    break;
-                }
+            case OP_RES:
+            case OP_RTI:
+            default:
+                reg[R_PC]--;
+                return {EXIT_ILLEGAL_OPCODE, reg[R_PC], executed - 1};
+        }
 
-                case TRAP_PUTSP: {
-                    uint16_t *c = machine->memory + reg[R_R0];
-                    // assume each memory address stores 2 characters. 1 character in 1 byte, like in modern systems
+        if constexpr (P::watch) {
+            if (machine->hit.kind) {
+                return {EXIT_WATCHPOINT, reg[R_PC], executed};
+            }
+        }
+    }
+    return {EXIT_BUDGET, reg[R_PC], executed};
+}
 
-                    while (*c != 0x0000) {
-                        char char1 = (*c) & 0xFF;
-                        char char2 = (*c) >> 8;
-                        std::cout << char1;
-                        if (char2) std::cout << char2;
-                        c++;
-                    }
+typedef run_result (*interpreter)(LC3_Machine *machine, uint64_t budget);
 
-                    break;
-                }
+template <unsigned... FEATURES>
+constexpr std::array<interpreter, sizeof...(FEATURES)> make_interpreters(std::integer_sequence<unsigned, FEATURES...>) {
+    return {interpret<run_policy<FEATURES>>...};
+}
 
-                case TRAP_HALT:
-                    std::cout << "HALT" << std::endl;
-                    return 0;
-                    break;
-            }
+// indexed by the RUN_* bits
+const auto interpreters = make_interpreters(std::make_integer_sequence<unsigned, RUN_ALL + 1>());
 
+}
 
-            break;
-        }
+run_result run_interpreter(LC3_Machine *machine, uint64_t budget, unsigned features) {
+    return interpreters[features & RUN_ALL](machine, budget);
+}
+
+int run_switch(LC3_Machine *machine, unsigned features) {
+    run_result result = run_interpreter(machine, UINT64_MAX, features);
 
-        case OP_RES:
-        case OP_RTI:
-        default:
-            throw std::runtime_error("Bad Instruction");
-            break;
+    if (result.reason == EXIT_ILLEGAL_OPCODE) {
+        throw std::runtime_error("Bad Instruction");
     }
-    return 1;
+    return result.reason != EXIT_HALTED;
 }
 
+int run_loop(LC3_Machine *machine, bool debug) {
+    run_result result = run_interpreter(machine, 1, debug ? RUN_TRACE : 0);
 
-void push(uint16_t val, LC3_Machine *machine) {
-    mem_write(machine->reg[R_R6], val, machine);
-    machine->counter++;
-    machine->reg[R_R6]--;
+    if (result.reason == EXIT_ILLEGAL_OPCODE) {
+        throw std::runtime_error("Bad Instruction");
+    }
+    return result.reason != EXIT_HALTED;
 }
 
-uint16_t pop(LC3_Machine *machine) {
-    machine->reg[R_R6]--;
-    uint16_t return_addr = 0x0000;
 
-    while (machine->counter > 0) {
-        if (machine->counter == 1) {
-            return_addr = mem_read(machine->reg[R_R6], machine);
-        }
-        mem_write(machine->reg[R_R6], 0x0000, machine);
-        machine->counter--;
-        machine->reg[R_R6]--;
+void push(uint16_t return_addr, LC3_Machine *machine) {
+    // deeper than depth can count, stop tracking rather than wrap around, but remember the call so
+    // its return doesn't take an outer frame with it
+    if (machine->depth == UINT16_MAX) {
+        machine->untracked++;
+        return;
     }
+    machine->frames.push_back(return_addr);
+    machine->depth++;
+}
 
+uint16_t pop(LC3_Machine *machine) {
+    // returning from a call push couldn't keep
+    if (machine->untracked) {
+        machine->untracked--;
+        return 0x0000;
+    }
+    // RET without a JSR before it, nothing to pop
+    if (machine->depth == 0) {
+        return 0x0000;
+    }
     machine->depth--;
 
-    if (machine->depth > 0) {
-        machine->counter = mem_read(machine->reg[R_R6], machine);
-        mem_write(machine->reg[R_R6], 0x0000, machine);
+    uint16_t return_addr = machine->frames.back();
+    machine->frames.pop_back();
+    return return_addr;
+}
+
+uint64_t run_profile::instructions() const {
+    uint64_t total = 0;
+    for (uint64_t count : ops) {
+        total += count;
     }
+    return total;
+}
 
-    return return_addr;
+uint64_t run_profile::self(uint32_t node) const {
+    return calls[node].self + (node == current ? instructions() - settled : 0);
 }
 
-// plan for stack
-/*
+// only calls and returns move between nodes, so instead of counting into current on every
+// instruction, everything since the last one goes to it here
+void run_profile::settle() {
+    uint64_t total = instructions();
+    calls[current].self += total - settled;
+    settled = total;
+}
 
-stack is stored on the memory from:
-0xFD00 to 0xF800 or 0xF000
+void run_profile::enter(uint16_t routine) {
+    settle();
+    auto [child, added] = children.try_emplace((uint64_t)current << 16 | routine, calls.size());
+    if (added) {
+        call_node node;
+        node.routine = routine;
+        node.parent = current;
+        calls.push_back(node);
+    }
+    current = child->second;
+    calls[current].calls++;
+}
 
-have a counter in the LC3 that keeps track of how many functions deep we're in, and once we're back to 0, we know we're in main (standard flow)
+void run_profile::leave() {
+    // RET without a JSR before it stays where it is, like pop
+    if (current != 0) {
+        settle();
+        current = calls[current].parent;
+    }
+}
 
-Then, if we call a function inside a function, we store our current count to the top of the stack
-When the next function ends, and we need to jump to R7, IF our current count is greater than 0, we retrieve our previous count, and keep going
+// plan for stack
+/*
 
-Need to know that R7 points to the return address of the function
-So once we detect that we jump to R7, we know we need to POP something from the stack
+The call stack lives on the host side, in LC3_Machine::frames, so nothing we do for bookkeeping ends up
+in guest memory or in R6. The guest is free to keep its own stack however it likes.
+
+depth keeps track of how many functions deep we're in, and once we're back to 0, we know we're in main (standard flow)
 
 The JSR function is the one that calls our function, and stores the return address in R7
-So, when JSR is called, we PUSH to the stack. 
-We can keep a counter of how many things are pushed during JSR and append that after the function jumps to R7
+So, when JSR is called, we PUSH its return address.
 
-probably need to make PUSH & POP functions
-*/
\ No newline at end of file
+Need to know that R7 points to the return address of the function
+So once we detect that we jump to R7, we POP the frame. Both are O(1), no matter how much the function did
+*/
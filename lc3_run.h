@@ -4,27 +4,130 @@
 #include <cstdint>
 #include <bitset>
 #include <signal.h>
-#include <Windows.h>
-#include <conio.h>
+#include <unordered_map>
+#include <vector>
 #include "lc3.h"
+#include "lc3_console.h"
 
 const int STACK_END = 0xF800;
 
-void disable_input_buffering();
+void mem_write(uint16_t address, uint16_t val, LC3_Machine *machine);
 
-void restore_input_buffering();
+uint16_t mem_read(uint16_t address, LC3_Machine *machine);
 
-uint16_t check_key();
+// the word an instruction fetch sees, mem_read without setting off watchpoints
+uint16_t fetch_word(uint16_t address, LC3_Machine *machine);
 
-void handle_interrupt(int signal);
+lc3_decoded fetch_decoded(uint16_t address, LC3_Machine *machine);
 
-void mem_write(uint16_t address, uint16_t val, LC3_Machine *machine);
+void invalidate_decoded(uint16_t address, LC3_Machine *machine);
 
-uint16_t mem_read(uint16_t address, LC3_Machine *machine);
+void clear_decoded(LC3_Machine *machine);
 
+// runs one instruction, printing it first when debug is set. Returns 0 once the program halts
 int run_loop(LC3_Machine *machine, bool debug = false);
 
-void push(uint16_t val, LC3_Machine *machine);
+// breakpoints go in machine->breakpoints and replace the decode cache entry with OP_BREAKPOINT, so
+// run_for/run_until and run_interpreter with RUN_BREAKPOINTS stop there without checking every pc
+void set_breakpoint(uint16_t address, LC3_Machine *machine);
+
+void clear_breakpoint(uint16_t address, LC3_Machine *machine);
+
+// puts OP_BREAKPOINT back for every breakpoint, after the decode cache was swapped out under them
+void mark_breakpoints(LC3_Machine *machine);
+
+// true if head starts a loop that only polls the keyboard: LDI Rn reading MR_KBSR, then a BR back
+// to the LDI taken while no key is there (BRz, BRzp, ...)
+bool kbsr_poll_loop(uint16_t head, LC3_Machine *machine);
+
+// kbsr_poll_loop, and going around it again can't change anything until a key shows up
+bool kbsr_idle(uint16_t head, LC3_Machine *machine);
+
+// why run_for/run_until came back
+enum run_exit {
+    EXIT_HALTED,         // TRAP_HALT ran
+    EXIT_BUDGET,         // ran every instruction it was allowed to
+    EXIT_BREAKPOINT,     // about to run the instruction at the breakpoint (run_until's, or set_breakpoint)
+    EXIT_ILLEGAL_OPCODE, // RTI or RES, pc is that instruction
+    EXIT_WATCHPOINT,     // the last instruction ran into a watchpoint (machine->hit), run_interpreter with RUN_WATCH only
+    EXIT_TRAP_IO         // GETC/IN or a KBSR polling loop with no key waiting, only with yield_on_input set.
+                         // pc is the trap or the loop, run again once there's input
+};
+
+struct run_result {
+    run_exit reason;
+    uint16_t pc;       // where execution picks up again, same as reg[R_PC]
+    uint64_t executed; // instructions run by this call
+};
+
+// Batch execution on the threaded engine (lc3_threaded.cc). Runs up to budget instructions in one go,
+// without coming back out per instruction, and reports why it stopped instead of throwing. Stops
+// before any breakpoint set with set_breakpoint except on the first instruction
+run_result run_for(LC3_Machine *machine, uint64_t budget);
+
+// same, but also stops before running the instruction at breakpoint. The first instruction always
+// runs, so calling it again continues past the breakpoint
+run_result run_until(LC3_Machine *machine, uint16_t breakpoint, uint64_t budget = UINT64_MAX);
+
+// extra work the switch interpreter does per instruction. Each combination is compiled into its own
+// copy of the loop (lc3_run.cc), so whatever is off costs nothing
+enum {
+    RUN_TRACE = 1 << 0,       /* print each instruction as it runs, what the debugger's step shows */
+    RUN_PROFILE = 1 << 1,     /* count instructions into machine->profile */
+    RUN_BREAKPOINTS = 1 << 2, /* stop before any breakpoint (set_breakpoint), otherwise they're run through */
+    RUN_WATCH = 1 << 3,       /* stop after an instruction that ran into a watchpoint (lc3_watch.h) */
+    RUN_ALL = (1 << 4) - 1
+};
+
+// a routine in the dynamic call tree, once for every different chain of calls that got to it
+struct call_node {
+    uint16_t routine = 0; // where the JSR/JSRR went
+    uint32_t parent = 0;
+    uint64_t calls = 0;
+    uint64_t self = 0;    // instructions run in it, not counting the routines it called (see run_profile::settled)
+};
+
+// filled in while running with RUN_PROFILE, lc3_profile.h turns it into a report
+struct run_profile {
+    uint64_t ops[16] = {};           // instructions run, by opcode
+    std::vector<uint64_t> pcs;       // by address
+    std::vector<uint64_t> taken;     // BRs at that address that branched
+    std::vector<uint64_t> not_taken; // and that fell through
+
+    // JSR/JSRR go down into the routine they call and JMP R7 comes back up, same as push/pop.
+    // calls[0] is everything outside of any routine, calls[current] is where we are now
+    std::vector<call_node> calls;
+    uint32_t current = 0;
+    std::unordered_map<uint64_t, uint32_t> children; // parent << 16 | routine, to its node
+    uint64_t settled = 0; // instructions already added to some node's self, the rest belong to current
+
+    run_profile() : pcs(MEMORY_MAX), taken(MEMORY_MAX), not_taken(MEMORY_MAX), calls(1) {}
+
+    void enter(uint16_t routine);
+    void leave();
+
+    // everything counted in ops so far
+    uint64_t instructions() const;
+    // calls[node].self, with what current has run since the last call or return
+    uint64_t self(uint32_t node) const;
+
+    private:
+        void settle();
+};
+
+// the switch interpreter, same contract as run_for. The JIT only gets to run code when none of
+// RUN_TRACE, RUN_PROFILE, RUN_BREAKPOINTS or RUN_WATCH are set
+run_result run_interpreter(LC3_Machine *machine, uint64_t budget, unsigned features = 0);
+
+// runs the program on the switch interpreter until it halts, like run_threaded
+int run_switch(LC3_Machine *machine, unsigned features = 0);
+
+// runs whatever machine->traps has for vector (lc3_trap.cc), returns 0 once the program halts.
+// reg[R_PC] and R7 have to be past the TRAP already
+int run_trap(uint16_t vector, LC3_Machine *machine);
+
+// call stack, see LC3_Machine::frames
+void push(uint16_t return_addr, LC3_Machine *machine);
 
 uint16_t pop(LC3_Machine *machine);
 
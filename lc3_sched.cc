@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_sched.h"
+
+namespace {
+
+bool has_input(LC3_Machine *machine) {
+    return machine->io->check_key() || machine->io->input_ended();
+}
+
+}
+
+LC3_Scheduler::LC3_Scheduler(uint64_t quantum) : quantum(quantum) {}
+
+int LC3_Scheduler::add(LC3_Machine *machine, uint64_t max_instructions, double max_ms) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    machine->yield_on_input = true;
+    tasks.push_back({machine, TASK_RUNNABLE, max_instructions, max_ms});
+    runnable.push_back(tasks.size() - 1);
+    changed.notify_one();
+    return tasks.size() - 1;
+}
+
+const sched_task &LC3_Scheduler::task(int id) const {
+    return tasks[id];
+}
+
+void LC3_Scheduler::wake(int id) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (tasks[id].state == TASK_PARKED && has_input(tasks[id].machine)) {
+        std::erase(parked, id);
+        tasks[id].state = TASK_RUNNABLE;
+        runnable.push_back(id);
+        changed.notify_one();
+    }
+}
+
+// called with lock held
+void LC3_Scheduler::finish_turn(int id, int reason, uint64_t executed, double ms) {
+    sched_task &t = tasks[id];
+    t.executed += executed;
+    t.used_ms += ms;
+
+    if (reason == EXIT_HALTED) {
+        t.state = TASK_HALTED;
+    }
+    else if (reason == EXIT_ILLEGAL_OPCODE) {
+        t.state = TASK_ILLEGAL_OPCODE;
+    }
+    else if (t.executed >= t.max_instructions) {
+        t.state = TASK_OUT_OF_INSTRUCTIONS;
+    }
+    else if (t.max_ms && t.used_ms >= t.max_ms) {
+        t.state = TASK_OUT_OF_TIME;
+    }
+    else if (reason == EXIT_TRAP_IO && !has_input(t.machine)) {
+        // parked only if no input came in during the turn, a wake that came with it found it running
+        t.state = TASK_PARKED;
+        parked.push_back(id);
+    }
+    else {
+        t.state = TASK_RUNNABLE;
+        runnable.push_back(id);
+    }
+}
+
+void LC3_Scheduler::worker() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        if (runnable.empty()) {
+            if (parked.empty() && running == 0) {
+                // nothing left that could ever run again
+                changed.notify_all();
+                return;
+            }
+            // until a turn ends or wake queues a parked machine
+            changed.wait(guard);
+            continue;
+        }
+
+        int id = runnable.front();
+        runnable.pop_front();
+        running++;
+
+        // add can move tasks around while we're unlocked, don't hold on to a reference
+        LC3_Machine *machine = tasks[id].machine;
+        uint64_t budget = std::min(quantum, tasks[id].max_instructions - tasks[id].executed);
+        guard.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        run_result result = run_for(machine, budget);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        guard.lock();
+        running--;
+        finish_turn(id, result.reason, result.executed, ms);
+        changed.notify_all();
+    }
+}
+
+void LC3_Scheduler::run(unsigned threads) {
+    std::vector<std::thread> helpers;
+    for (unsigned i = 1; i < threads; i++) {
+        helpers.emplace_back(&LC3_Scheduler::worker, this);
+    }
+    worker();
+
+    for (std::thread &t : helpers) {
+        t.join();
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef LC3_SCHED_H
+#define LC3_SCHED_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "lc3.h"
+
+// Runs many machines on a few host threads. Each turn a machine gets quantum instructions through
+// run_for, then goes to the back of the queue. Machines waiting on GETC/IN or spinning on KBSR with nothing
+// to read are parked instead (run_for returns EXIT_TRAP_IO, see yield_on_input) and only queued again by wake,
+// once their io has a key or has ended. Nothing here blocks on a single guest's input.
+//
+// A machine's io is read by whichever worker thread has its turn, and by wake and the end of each turn to
+// see if it can go again. Anything handing it input from another thread has to make that safe itself
+// (a Buffer_IO can't be appended to while the scheduler runs, a Pipe_IO can), then call wake. run -batch
+// with -guests (batch_run.h) runs a manifest's jobs this way.
+
+enum {
+    TASK_RUNNABLE,
+    TASK_PARKED,      // waiting for input
+    TASK_HALTED,
+    TASK_ILLEGAL_OPCODE,
+    TASK_OUT_OF_INSTRUCTIONS, // used up max_instructions
+    TASK_OUT_OF_TIME          // used up max_ms
+};
+
+struct sched_task {
+    LC3_Machine *machine;
+    int state = TASK_RUNNABLE;
+
+    // quotas, checked between turns, so a machine can go over by up to one quantum
+    uint64_t max_instructions;
+    double max_ms;             // host time spent running it, 0 for no limit
+
+    uint64_t executed = 0;
+    double used_ms = 0;
+};
+
+class LC3_Scheduler {
+    std::vector<sched_task> tasks;
+    std::deque<int> runnable;
+    std::vector<int> parked;
+    unsigned running = 0; // turns in progress
+
+    std::mutex lock;
+    std::condition_variable changed; // runnable or running changed
+
+    uint64_t quantum;
+
+    void worker();
+    void finish_turn(int id, int reason, uint64_t executed, double ms);
+
+    public:
+        explicit LC3_Scheduler(uint64_t quantum = 10000);
+
+        // machine isn't owned, and has to stay around until run returns. Sets yield_on_input.
+        // Returns the id for task and wake
+        int add(LC3_Machine *machine, uint64_t max_instructions = UINT64_MAX, double max_ms = 0);
+
+        // checks a parked machine's io again and queues it if there's a key or input has ended. Nothing
+        // else looks at parked machines, call this after handing one input. Calling it while the machine
+        // is still running is fine, its io is looked at again before it gets parked
+        void wake(int id);
+
+        // runs every machine until it stops (halts, hits a quota or an illegal opcode) on threads
+        // threads, this one included
+        void run(unsigned threads = 1);
+
+        const sched_task &task(int id) const;
+};
+
+#endif
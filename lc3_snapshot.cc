@@ -0,0 +1,64 @@
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_snapshot.h"
+
+namespace {
+
+std::atomic<uint64_t> next_id{1};
+
+void restore_page(LC3_Machine *machine, const LC3_Snapshot &snapshot, uint16_t page) {
+    uint16_t *memory = machine->memory + (page << PAGE_SHIFT);
+    const uint16_t *saved = snapshot.memory + (page << PAGE_SHIFT);
+
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        if (memory[i] != saved[i]) {
+            memory[i] = saved[i];
+            invalidate_decoded((page << PAGE_SHIFT) + i, machine);
+        }
+    }
+}
+
+}
+
+void take_snapshot(LC3_Machine *machine, LC3_Snapshot &snapshot) {
+    std::memcpy(snapshot.memory, machine->memory, sizeof(snapshot.memory));
+    std::memcpy(snapshot.reg, machine->reg, sizeof(snapshot.reg));
+    snapshot.flag_value = machine->flag_value;
+    snapshot.frames = machine->frames;
+    snapshot.depth = machine->depth;
+    snapshot.untracked = machine->untracked;
+
+    std::memset(machine->dirty, 0, sizeof(machine->dirty));
+    snapshot.id = next_id++;
+    machine->dirty_since = snapshot.id;
+}
+
+void restore_snapshot(LC3_Machine *machine, const LC3_Snapshot &snapshot) {
+    if (snapshot.id && machine->dirty_since == snapshot.id) {
+        for (int i = 0; i < PAGE_COUNT / 64; i++) {
+            // one page per set bit, lowest first
+            for (uint64_t bits = machine->dirty[i]; bits; bits &= bits - 1) {
+                restore_page(machine, snapshot, i * 64 + std::countr_zero(bits));
+            }
+        }
+    }
+    else {
+        for (int page = 0; page < PAGE_COUNT; page++) {
+            restore_page(machine, snapshot, page);
+        }
+    }
+
+    std::memcpy(machine->reg, snapshot.reg, sizeof(machine->reg));
+    machine->flag_value = snapshot.flag_value;
+    machine->frames = snapshot.frames;
+    machine->depth = snapshot.depth;
+    machine->untracked = snapshot.untracked;
+
+    std::memset(machine->dirty, 0, sizeof(machine->dirty));
+    machine->dirty_since = snapshot.id;
+}
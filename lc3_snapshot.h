@@ -0,0 +1,32 @@
+#ifndef LC3_SNAPSHOT_H
+#define LC3_SNAPSHOT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "lc3.h"
+
+// Saved machine state. Every store marks its page in LC3_Machine::dirty, so going back to the
+// snapshot the machine last took or restored only copies the pages written since then. Going back
+// to any other snapshot copies all of memory.
+// The keyboard and display (LC3_Machine::io) aren't part of it, rewind those separately
+struct LC3_Snapshot {
+    uint16_t memory[MEMORY_MAX];
+    uint16_t reg[R_COUNT];
+    uint16_t flag_value;
+    std::vector<uint16_t> frames;
+    uint16_t depth;
+    uint64_t untracked;
+
+    // set by take_snapshot, copies share it since they hold the same state
+    uint64_t id = 0;
+};
+
+// copies the whole machine, and starts tracking dirty pages against this snapshot
+void take_snapshot(LC3_Machine *machine, LC3_Snapshot &snapshot);
+
+// puts the machine back the way it was when snapshot was taken. Only words that actually differ
+// are written, so the decode cache and JIT keep everything that's still valid
+void restore_snapshot(LC3_Machine *machine, const LC3_Snapshot &snapshot);
+
+#endif
@@ -0,0 +1,434 @@
+#include <cstdint>
+#include <stdexcept>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_threaded.h"
+
+#if defined(__GNUC__) && !defined(LC3_NO_COMPUTED_GOTO)
+#define LC3_COMPUTED_GOTO 1
+#endif
+
+namespace {
+
+// everything a handler touches. pc lives here instead of reg[R_PC] while we run, and is only
+// written back when something outside the engine could look at it
+struct thread_state {
+    LC3_Machine *machine;
+    uint16_t *reg;
+    lc3_decoded *decoded;
+    uint16_t pc;
+    uint64_t budget;   // instructions we're still allowed to start
+    uint64_t limit;    // budget the call started with
+    uint16_t stop;     // breakpoint for run_until
+    bool has_stop;
+};
+
+// handlers return this to keep going, or a run_exit to stop
+const int RUN_ON = -1;
+
+// the instruction semantics, shared by both dispatch methods below. These match run_loop exactly
+
+inline void exec_add(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = s.reg[instr.sr1] + (instr.imm ? instr.offset : s.reg[instr.sr2]);
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_and(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = s.reg[instr.sr1] & (instr.imm ? instr.offset : s.reg[instr.sr2]);
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_not(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = ~s.reg[instr.sr1];
+    update_flags(instr.dr, s.machine);
+}
+
+inline int exec_br(thread_state &s, lc3_decoded instr) {
+    if (instr.dr & get_flags(s.machine)) {
+        s.pc += instr.offset;
+
+        // back onto the instruction before it, could be a loop waiting on the keyboard
+        if (instr.offset == 0xFFFE && kbsr_idle(s.pc, s.machine)) {
+            if (s.machine->yield_on_input) {
+                return EXIT_TRAP_IO;
+            }
+            s.machine->io->wait_key();
+        }
+    }
+    return RUN_ON;
+}
+
+inline void exec_jmp(thread_state &s, lc3_decoded instr) {
+    if (instr.sr1 == R_R7) {
+        pop(s.machine);
+    }
+    s.pc = s.reg[instr.sr1];
+}
+
+inline void exec_jsr(thread_state &s, lc3_decoded instr) {
+    push(s.pc, s.machine);
+    s.reg[R_R7] = s.pc;
+    s.pc = instr.imm ? s.pc + instr.offset : s.reg[instr.sr1];
+}
+
+inline void exec_ld(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = mem_read(s.pc + instr.offset, s.machine);
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_ldi(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = mem_read(mem_read(s.pc + instr.offset, s.machine), s.machine);
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_ldr(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = mem_read(s.reg[instr.sr1] + instr.offset, s.machine);
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_lea(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = s.pc + instr.offset;
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_st(thread_state &s, lc3_decoded instr) {
+    mem_write(s.pc + instr.offset, s.reg[instr.dr], s.machine);
+}
+
+inline void exec_sti(thread_state &s, lc3_decoded instr) {
+    mem_write(mem_read(s.pc + instr.offset, s.machine), s.reg[instr.dr], s.machine);
+}
+
+inline void exec_str(thread_state &s, lc3_decoded instr) {
+    mem_write(s.reg[instr.sr1] + instr.offset, s.reg[instr.dr], s.machine);
+}
+
+inline int exec_trap(thread_state &s, lc3_decoded instr) {
+    if (s.machine->yield_on_input && (instr.offset == TRAP_GETC || instr.offset == TRAP_IN) &&
+        !s.machine->io->check_key() && !s.machine->io->input_ended()) {
+        // hand it to the host, the trap runs again once there's input
+        s.pc--;
+        s.budget++;
+        return EXIT_TRAP_IO;
+    }
+
+    s.reg[R_R7] = s.pc;
+    s.reg[R_PC] = s.pc;
+    int running = run_trap(instr.offset, s.machine);
+
+    // guest trap routines (and native handlers, if they like) move the pc
+    s.pc = s.reg[R_PC];
+    return running ? RUN_ON : EXIT_HALTED;
+}
+
+inline void exec_load_imm(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = s.decoded[s.pc++].offset;
+    update_flags(instr.dr, s.machine);
+}
+
+inline void exec_negate(thread_state &s, lc3_decoded instr) {
+    s.reg[instr.dr] = -s.reg[instr.sr1];
+    update_flags(instr.dr, s.machine);
+    s.pc++;
+}
+
+// a superinstruction runs the instructions after its first one only if the budget has room for them
+// and run_until's stop isn't one of them. Otherwise they're left to be dispatched one at a time
+inline bool can_fuse(thread_state &s, uint64_t length) {
+    if (s.budget < length - 1 || (s.has_stop && (uint16_t)(s.stop - s.pc) < length - 1)) {
+        return false;
+    }
+    s.budget -= length - 1;
+    return true;
+}
+
+// set_breakpoint's marker. Stops in front of it, unless it's the first instruction of the call, then
+// instr becomes the real instruction to run
+inline bool at_marked_breakpoint(thread_state &s, lc3_decoded &instr) {
+    if (s.limit - s.budget != 1) {
+        s.pc--;
+        s.budget++;
+        return true;
+    }
+    instr = decode(fetch_word(s.pc - 1, s.machine));
+    return false;
+}
+
+inline int bad_instruction(thread_state &s) {
+    s.pc--;
+    s.budget++;
+    return EXIT_ILLEGAL_OPCODE;
+}
+
+run_result finish(thread_state &s, int reason, uint64_t budget) {
+    s.reg[R_PC] = s.pc;
+    return {(run_exit)reason, s.pc, budget - s.budget};
+}
+
+#ifdef LC3_COMPUTED_GOTO
+
+template <bool STOP>
+run_result run_dispatch(LC3_Machine *machine, uint64_t budget, uint16_t stop) {
+    thread_state s{machine, machine->reg, machine->decoded, machine->reg[R_PC], budget, budget, stop, STOP};
+    lc3_decoded instr;
+    int reason;
+
+    // indexed by lc3_decoded::op
+    static void *const dispatch_table[] = {
+        &&op_br, &&op_add, &&op_ld, &&op_st, &&op_jsr, &&op_and, &&op_ldr, &&op_str,
+        &&op_bad, &&op_not, &&op_ldi, &&op_sti, &&op_jmp, &&op_bad, &&op_lea, &&op_trap,
+        &&op_undecoded, &&op_breakpoint,
+        &&op_add_br, &&op_ldr_add_str, &&op_load_imm, &&op_negate
+    };
+
+#define DISPATCH() do { \
+        if (s.budget == 0) goto out_of_budget; \
+        if (STOP && s.pc == stop) goto at_breakpoint; \
+        s.budget--; \
+        instr = s.decoded[s.pc++]; \
+        goto *dispatch_table[instr.op]; \
+    } while (0)
+
+    // the first instruction skips the breakpoint check, that's how run_until continues from one
+    if (s.budget == 0) goto out_of_budget;
+    s.budget--;
+    instr = s.decoded[s.pc++];
+    goto *dispatch_table[instr.op];
+
+op_undecoded:
+    instr = fetch_decoded(--s.pc, machine);
+    s.pc++;
+    goto *dispatch_table[instr.op];
+
+op_breakpoint:
+    if (at_marked_breakpoint(s, instr)) {
+        goto at_breakpoint;
+    }
+    goto *dispatch_table[instr.op];
+
+op_add: exec_add(s, instr); DISPATCH();
+op_and: exec_and(s, instr); DISPATCH();
+op_not: exec_not(s, instr); DISPATCH();
+op_br:
+    reason = exec_br(s, instr);
+    if (reason != RUN_ON) {
+        return finish(s, reason, budget);
+    }
+    DISPATCH();
+op_jmp: exec_jmp(s, instr); DISPATCH();
+op_jsr: exec_jsr(s, instr); DISPATCH();
+op_ld: exec_ld(s, instr); DISPATCH();
+op_ldi: exec_ldi(s, instr); DISPATCH();
+op_ldr: exec_ldr(s, instr); DISPATCH();
+op_lea: exec_lea(s, instr); DISPATCH();
+op_st: exec_st(s, instr); DISPATCH();
+op_sti: exec_sti(s, instr); DISPATCH();
+op_str: exec_str(s, instr); DISPATCH();
+
+op_trap:
+    reason = exec_trap(s, instr);
+    if (reason != RUN_ON) {
+        return finish(s, reason, budget);
+    }
+    DISPATCH();
+
+// superinstructions go straight to the handler of the next instruction, no dispatch in between
+op_add_br:
+    exec_add(s, instr);
+    if (can_fuse(s, 2)) {
+        instr = s.decoded[s.pc++];
+        goto op_br;
+    }
+    DISPATCH();
+op_ldr_add_str:
+    exec_ldr(s, instr);
+    if (can_fuse(s, 3)) {
+        exec_add(s, s.decoded[s.pc++]);
+        instr = s.decoded[s.pc++];
+        goto op_str;
+    }
+    DISPATCH();
+op_load_imm:
+    if (can_fuse(s, 2)) {
+        exec_load_imm(s, instr);
+        DISPATCH();
+    }
+    goto op_and;
+op_negate:
+    if (can_fuse(s, 2)) {
+        exec_negate(s, instr);
+        DISPATCH();
+    }
+    goto op_not;
+
+op_bad:
+    return finish(s, bad_instruction(s), budget);
+
+out_of_budget:
+    return finish(s, EXIT_BUDGET, budget);
+
+at_breakpoint:
+    return finish(s, EXIT_BREAKPOINT, budget);
+
+#undef DISPATCH
+}
+
+#else
+
+// portable version: one function per opcode. With musttail every handler jumps straight into the
+// next one, otherwise each handler returns to the loop in run_dispatch which calls the next one
+typedef int (*handler)(thread_state &s, lc3_decoded instr);
+
+extern const handler handlers[];
+
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define LC3_MUSTTAIL [[clang::musttail]]
+#endif
+#endif
+
+// anything other than running the next instruction is left to the loop in run_dispatch
+#ifdef LC3_MUSTTAIL
+#define NEXT(s) do { \
+        if ((s).budget == 0 || ((s).has_stop && (s).pc == (s).stop)) return RUN_ON; \
+        (s).budget--; \
+        lc3_decoded next = (s).decoded[(s).pc++]; \
+        LC3_MUSTTAIL return handlers[next.op]((s), next); \
+    } while (0)
+#else
+#define NEXT(s) return RUN_ON
+#endif
+
+int h_undecoded(thread_state &s, lc3_decoded) {
+    lc3_decoded instr = fetch_decoded(--s.pc, s.machine);
+    s.pc++;
+#ifdef LC3_MUSTTAIL
+    LC3_MUSTTAIL return handlers[instr.op](s, instr);
+#else
+    return handlers[instr.op](s, instr);
+#endif
+}
+
+int h_breakpoint(thread_state &s, lc3_decoded instr) {
+    if (at_marked_breakpoint(s, instr)) {
+        return EXIT_BREAKPOINT;
+    }
+#ifdef LC3_MUSTTAIL
+    LC3_MUSTTAIL return handlers[instr.op](s, instr);
+#else
+    return handlers[instr.op](s, instr);
+#endif
+}
+
+int h_add(thread_state &s, lc3_decoded instr) { exec_add(s, instr); NEXT(s); }
+int h_and(thread_state &s, lc3_decoded instr) { exec_and(s, instr); NEXT(s); }
+int h_not(thread_state &s, lc3_decoded instr) { exec_not(s, instr); NEXT(s); }
+int h_br(thread_state &s, lc3_decoded instr) {
+    int reason = exec_br(s, instr);
+    if (reason != RUN_ON) {
+        return reason;
+    }
+    NEXT(s);
+}
+int h_jmp(thread_state &s, lc3_decoded instr) { exec_jmp(s, instr); NEXT(s); }
+int h_jsr(thread_state &s, lc3_decoded instr) { exec_jsr(s, instr); NEXT(s); }
+int h_ld(thread_state &s, lc3_decoded instr) { exec_ld(s, instr); NEXT(s); }
+int h_ldi(thread_state &s, lc3_decoded instr) { exec_ldi(s, instr); NEXT(s); }
+int h_ldr(thread_state &s, lc3_decoded instr) { exec_ldr(s, instr); NEXT(s); }
+int h_lea(thread_state &s, lc3_decoded instr) { exec_lea(s, instr); NEXT(s); }
+int h_st(thread_state &s, lc3_decoded instr) { exec_st(s, instr); NEXT(s); }
+int h_sti(thread_state &s, lc3_decoded instr) { exec_sti(s, instr); NEXT(s); }
+int h_str(thread_state &s, lc3_decoded instr) { exec_str(s, instr); NEXT(s); }
+
+int h_trap(thread_state &s, lc3_decoded instr) {
+    int reason = exec_trap(s, instr);
+    if (reason != RUN_ON) {
+        return reason;
+    }
+    NEXT(s);
+}
+
+int h_bad(thread_state &s, lc3_decoded) { return bad_instruction(s); }
+
+int h_add_br(thread_state &s, lc3_decoded instr) {
+    exec_add(s, instr);
+    if (can_fuse(s, 2)) {
+        int reason = exec_br(s, s.decoded[s.pc++]);
+        if (reason != RUN_ON) {
+            return reason;
+        }
+    }
+    NEXT(s);
+}
+int h_ldr_add_str(thread_state &s, lc3_decoded instr) {
+    exec_ldr(s, instr);
+    if (can_fuse(s, 3)) {
+        exec_add(s, s.decoded[s.pc++]);
+        exec_str(s, s.decoded[s.pc++]);
+    }
+    NEXT(s);
+}
+int h_load_imm(thread_state &s, lc3_decoded instr) {
+    if (can_fuse(s, 2)) exec_load_imm(s, instr);
+    else exec_and(s, instr);
+    NEXT(s);
+}
+int h_negate(thread_state &s, lc3_decoded instr) {
+    if (can_fuse(s, 2)) exec_negate(s, instr);
+    else exec_not(s, instr);
+    NEXT(s);
+}
+
+// indexed by lc3_decoded::op
+const handler handlers[] = {
+    h_br, h_add, h_ld, h_st, h_jsr, h_and, h_ldr, h_str,
+    h_bad, h_not, h_ldi, h_sti, h_jmp, h_bad, h_lea, h_trap,
+    h_undecoded, h_breakpoint,
+    h_add_br, h_ldr_add_str, h_load_imm, h_negate
+};
+
+template <bool STOP>
+run_result run_dispatch(LC3_Machine *machine, uint64_t budget, uint16_t stop) {
+    thread_state s{machine, machine->reg, machine->decoded, machine->reg[R_PC], budget, budget, stop, STOP};
+    bool first = true;
+
+    while (true) {
+        if (s.budget == 0) {
+            return finish(s, EXIT_BUDGET, budget);
+        }
+        // the first instruction skips the breakpoint check, that's how run_until continues from one
+        if (STOP && !first && s.pc == stop) {
+            return finish(s, EXIT_BREAKPOINT, budget);
+        }
+        first = false;
+
+        s.budget--;
+        lc3_decoded instr = s.decoded[s.pc++];
+        int reason = handlers[instr.op](s, instr);
+        if (reason != RUN_ON) {
+            return finish(s, reason, budget);
+        }
+    }
+}
+
+#endif
+
+}
+
+run_result run_for(LC3_Machine *machine, uint64_t budget) {
+    return run_dispatch<false>(machine, budget, 0);
+}
+
+run_result run_until(LC3_Machine *machine, uint16_t breakpoint, uint64_t budget) {
+    return run_dispatch<true>(machine, budget, breakpoint);
+}
+
+int run_threaded(LC3_Machine *machine) {
+    run_result result = run_for(machine, UINT64_MAX);
+
+    if (result.reason == EXIT_ILLEGAL_OPCODE) {
+        throw std::runtime_error("Bad Instruction");
+    }
+    return result.reason != EXIT_HALTED;
+}
@@ -0,0 +1,13 @@
+#ifndef LC3_THREADED_H
+#define LC3_THREADED_H
+
+#include "lc3.h"
+
+// Threaded engine: instead of going through run_loop once per instruction, each handler jumps
+// straight to the handler of the next pre-decoded instruction. Runs until the program halts.
+// Uses computed goto where the compiler has it (gcc/clang), tail calls between handler functions otherwise.
+// run_for/run_until (lc3_run.h) run on this engine too, this is just the run-to-halt case.
+// Returns 0 once the program halts
+int run_threaded(LC3_Machine *machine);
+
+#endif
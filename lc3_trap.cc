@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <string>
+
+#include "lc3.h"
+#include "lc3_run.h"
+#include "lc3_trap.h"
+
+namespace {
+
+int trap_getc(LC3_Machine *machine) {
+    machine->io->flush();
+    machine->reg[R_R0] = (uint16_t)machine->io->read_key();
+    update_flags(R_R0, machine);
+    return 1;
+}
+
+int trap_out(LC3_Machine *machine) {
+    machine->io->put((char)machine->reg[R_R0]);
+    return 1;
+}
+
+int trap_puts(LC3_Machine *machine) {
+    // wraps around at xFFFF instead of running off the end of memory
+    uint16_t c = machine->reg[R_R0];
+    std::string text;
+
+    while (machine->memory[c] != 0x0000 && text.size() < MEMORY_MAX) {
+        char curr = machine->memory[c];
+
+        text += curr;
+        c++;
+    }
+
+    machine->io->write(text.data(), text.size());
+    return 1;
+}
+
+int trap_in(LC3_Machine *machine) {
+    machine->io->write("Enter a character\n", 18);
+    machine->io->flush();
+    int key = machine->io->read_key();
+    // -1 is input running out, there's no character to show
+    if (key != -1) {
+        char echo[] = {(char)key, '\n'};
+        machine->io->write(echo, 2);
+    }
+    machine->reg[R_R0] = (uint16_t)key;
+    update_flags(R_R0, machine);
+    return 1;
+}
+
+int trap_putsp(LC3_Machine *machine) {
+    uint16_t c = machine->reg[R_R0];
+    // assume each memory address stores 2 characters. 1 character in 1 byte, like in modern systems
+    std::string text;
+
+    for (int n = 0; machine->memory[c] != 0x0000 && n < MEMORY_MAX; n++) {
+        char char1 = machine->memory[c] & 0xFF;
+        char char2 = machine->memory[c] >> 8;
+        text += char1;
+        if (char2) text += char2;
+        c++;
+    }
+
+    machine->io->write(text.data(), text.size());
+    return 1;
+}
+
+int trap_halt(LC3_Machine *machine) {
+    machine->io->write("HALT\n", 5);
+    machine->io->flush();
+    return 0;
+}
+
+}
+
+LC3_Trap_Table make_trap_table(bool guest_fallback) {
+    LC3_Trap_Table table;
+
+    if (guest_fallback) {
+        for (int vector = 0; vector < 256; vector++) {
+            set_guest_trap(table, vector);
+        }
+    }
+
+    set_trap(table, TRAP_GETC, trap_getc);
+    set_trap(table, TRAP_OUT, trap_out);
+    set_trap(table, TRAP_PUTS, trap_puts);
+    set_trap(table, TRAP_IN, trap_in);
+    set_trap(table, TRAP_PUTSP, trap_putsp);
+    set_trap(table, TRAP_HALT, trap_halt);
+    return table;
+}
+
+const LC3_Trap_Table *default_traps() {
+    static const LC3_Trap_Table table = make_trap_table();
+    return &table;
+}
+
+void set_trap(LC3_Trap_Table &table, uint8_t vector, trap_handler handler) {
+    table.entries[vector] = {TH_NATIVE, std::move(handler)};
+}
+
+void set_guest_trap(LC3_Trap_Table &table, uint8_t vector) {
+    table.entries[vector] = {TH_GUEST, nullptr};
+}
+
+int run_trap(uint16_t vector, LC3_Machine *machine) {
+    const trap_entry &entry = machine->traps->entries[vector & 0xFF];
+
+    switch (entry.kind) {
+        case TH_NATIVE:
+            return entry.handler(machine);
+
+        case TH_GUEST:
+            // the routine returns with RET, so it's a call as far as the stack goes
+            push(machine->reg[R_PC], machine);
+            machine->reg[R_PC] = mem_read(vector, machine);
+            break;
+    }
+    return 1;
+}
+
+int trap_multiply(LC3_Machine *machine) {
+    uint16_t *reg = machine->reg;
+    reg[R_R0] = reg[R_R0] * reg[R_R1];
+    update_flags(R_R0, machine);
+    return 1;
+}
+
+int trap_divide(LC3_Machine *machine) {
+    uint16_t *reg = machine->reg;
+    int16_t a = reg[R_R0], b = reg[R_R1];
+
+    if (b != 0) {
+        reg[R_R0] = a / b;
+        reg[R_R1] = a % b;
+        update_flags(R_R0, machine);
+    }
+    return 1;
+}
+
+int trap_memcpy(LC3_Machine *machine) {
+    uint16_t *reg = machine->reg;
+    uint16_t from = reg[R_R0], to = reg[R_R1];
+
+    // through mem_read/mem_write so devices, the decode cache and dirty pages all see it
+    for (uint16_t n = reg[R_R2]; n; n--) {
+        mem_write(to++, mem_read(from++, machine), machine);
+    }
+    return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef LC3_TRAP_H
+#define LC3_TRAP_H
+
+#include <cstdint>
+#include <functional>
+
+#include "lc3.h"
+
+// What TRAP does for each of the 256 vectors. A vector can run a native handler, jump to the guest's
+// own routine at memory[vector] like real hardware, or do nothing (what every vector without a
+// handler used to do). Machines point at a table (LC3_Machine::traps), so one table can be shared by
+// any number of them.
+
+// runs with reg[R_PC] past the TRAP and R7 already set to it. Returns 0 to halt, same as run_trap
+typedef std::function<int(LC3_Machine *)> trap_handler;
+
+enum {
+    TH_NONE,   /* carry on with the next instruction */
+    TH_NATIVE, /* call handler */
+    TH_GUEST   /* jump to the routine at memory[vector] */
+};
+
+struct trap_entry {
+    int kind = TH_NONE;
+    trap_handler handler;
+};
+
+struct LC3_Trap_Table {
+    trap_entry entries[256];
+};
+
+// the standard six (GETC, OUT, PUTS, IN, PUTSP, HALT) natively. With guest_fallback every other
+// vector goes to the guest's routine, otherwise they do nothing
+LC3_Trap_Table make_trap_table(bool guest_fallback = false);
+
+void set_trap(LC3_Trap_Table &table, uint8_t vector, trap_handler handler);
+
+void set_guest_trap(LC3_Trap_Table &table, uint8_t vector);
+
+// ready made handlers for guest library routines that are slow in LC-3 code. Not in any table by
+// default, which vector a library uses for them is up to the library
+int trap_multiply(LC3_Machine *machine); // R0 = R0 * R1
+int trap_divide(LC3_Machine *machine);   // R0 = R0 / R1, R1 = R0 % R1, signed. Nothing changes if R1 is 0
+int trap_memcpy(LC3_Machine *machine);   // copies R2 words from R0 to R1, front to back
+
+#endif
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "lc3.h"
+#include "lc3_jit.h"
+#include "lc3_watch.h"
+
+namespace {
+
+// PAGE_WATCH for every page still touched by a watchpoint
+void update_watch_flags(LC3_Machine *machine) {
+    bool watched[PAGE_COUNT] = {};
+    for (const watchpoint &w : machine->watchpoints) {
+        for (int page = w.first >> PAGE_SHIFT; page <= w.last >> PAGE_SHIFT; page++) {
+            watched[page] = true;
+        }
+    }
+
+    bool changed = false;
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        if (watched[page] != bool(machine->page_flags[page] & PAGE_WATCH)) {
+            machine->page_flags[page] ^= PAGE_WATCH;
+            changed = true;
+        }
+    }
+
+    // translated loads from a page that just got watched go straight to memory. The decode cache
+    // is fine as it is, fetches aren't watched
+    if (changed) {
+        jit_flush(machine);
+    }
+}
+
+// what the word reads as without going through the watchpoints again
+uint16_t peek(uint16_t address, LC3_Machine *machine) {
+    if (machine->page_flags[address >> PAGE_SHIFT] & PAGE_MMIO) {
+        return 0;
+    }
+    return machine->memory[address];
+}
+
+}
+
+int add_watchpoint(LC3_Machine *machine, uint16_t first, uint16_t last, uint8_t kinds) {
+    int id = 1;
+    for (const watchpoint &w : machine->watchpoints) {
+        id = std::max(id, w.id + 1);
+    }
+    machine->watchpoints.push_back({id, first, last, kinds});
+    update_watch_flags(machine);
+    return id;
+}
+
+bool remove_watchpoint(LC3_Machine *machine, int id) {
+    size_t removed = std::erase_if(machine->watchpoints, [id](const watchpoint &w) { return w.id == id; });
+    update_watch_flags(machine);
+    return removed != 0;
+}
+
+void watch_read(uint16_t address, LC3_Machine *machine) {
+    for (const watchpoint &w : machine->watchpoints) {
+        if ((w.kinds & WATCH_READ) && w.first <= address && address <= w.last) {
+            // device registers can change on a read, so there's no value to show for those
+            uint16_t value = peek(address, machine);
+            machine->hit = {w.id, WATCH_READ, address, value, value};
+            return;
+        }
+    }
+}
+
+void watch_write(uint16_t address, uint16_t val, LC3_Machine *machine) {
+    uint16_t old_value = peek(address, machine);
+
+    for (const watchpoint &w : machine->watchpoints) {
+        if (address < w.first || w.last < address) {
+            continue;
+        }
+        if (w.kinds & WATCH_WRITE) {
+            machine->hit = {w.id, WATCH_WRITE, address, old_value, val};
+            return;
+        }
+        if ((w.kinds & WATCH_CHANGE) && val != old_value) {
+            machine->hit = {w.id, WATCH_CHANGE, address, old_value, val};
+            return;
+        }
+    }
+}
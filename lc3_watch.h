@@ -0,0 +1,26 @@
+#ifndef LC3_WATCH_H
+#define LC3_WATCH_H
+
+#include <cstdint>
+
+#include "lc3.h"
+
+// Watchpoints on address ranges. Every page with a watchpoint on it gets PAGE_WATCH in
+// LC3_Machine::page_flags, and only loads and stores on those pages take the slow path in
+// mem_read/mem_write that checks them, the same way devices work (lc3_bus.h). Instruction fetches
+// don't count as reads.
+//
+// A matching access is recorded in LC3_Machine::hit. run_interpreter with RUN_WATCH stops after the
+// instruction that made it, the other engines just leave it there.
+
+// watches first..last (inclusive) for the WATCH_* bits in kinds, returns the watchpoint's id
+int add_watchpoint(LC3_Machine *machine, uint16_t first, uint16_t last, uint8_t kinds);
+
+// false if there's no watchpoint with that id
+bool remove_watchpoint(LC3_Machine *machine, int id);
+
+// mem_read/mem_write for addresses on a PAGE_WATCH page, before the access happens
+void watch_read(uint16_t address, LC3_Machine *machine);
+void watch_write(uint16_t address, uint16_t val, LC3_Machine *machine);
+
+#endif
@@ -5,42 +5,26 @@
 #include <bitset>
 #include <signal.h>
 #include <cstdint>
+#include <vector>
+#include <memory>
 
 #include "lc3.h"
 #include "lc3_run.h"
+#include "lc3_threaded.h"
+#include "lc3_jit.h"
+#include "lc3_output.h"
+#include "lc3_loader.h"
+#include "lc3_trap.h"
+#include "lc3_replay.h"
+#include "lc3_headless.h"
+#include "lc3_profile.h"
+#include "batch_run.h"
 
 #include "lc3_debug.h"
 #include "debug_run.h"
 
 using std::string;
 
-void read_image_file(std::ifstream &ifs, LC3_Machine *machine) {
-    uint16_t origin;
-
-    // big endian to little endian
-    ifs.read(reinterpret_cast<char *>(&origin), sizeof(origin));
-
-    swap16(origin); // Swap is needed if the input is in big endian, then we want to convert it into little endian
-
-    uint16_t *max_read = machine->memory + MEMORY_MAX - 1;
-    uint16_t *p = machine->memory + origin;
-
-    while (p != max_read && ifs) {
-        ifs.read(reinterpret_cast<char *>(p), sizeof(origin));
-        swap16(*p); // same as above
-        p++;
-    }
-}
-
-int read_image(std::ifstream &ifs, LC3_Machine *machine) {
-    if (!ifs) {
-        throw std::runtime_error("Invalid File provided");
-    }
-
-    read_image_file(ifs, machine);
-    return 1;
-}
-
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         throw std::runtime_error("Not enough arguments provided (image is probably missing)");
@@ -55,34 +39,282 @@ int main(int argc, char *argv[]) {
 
     string file_name = argv[1];
 
-    if (argc == 3) {
-        string mode_string = argv[2];
+    // run -batch <manifest> [-threads=<n>] [-max-instructions=<n>] [-guests], see batch_run.h
+    if (file_name == "-batch") {
+        if (argc < 3) {
+            throw std::runtime_error("Not enough arguments provided (manifest is probably missing)");
+        }
 
-        if (mode_string != "-debug") {
-            throw std::runtime_error("Invalid debug mode provided. Available commands are: -debug" );
+        unsigned threads = 0;
+        uint64_t max_instructions = 1000000000;
+        double timeout_ms = 0;
+        bool guests = false;
+
+        for (int i = 3; i < argc; i++) {
+            string option = argv[i];
+
+            if (option.rfind("-threads=", 0) == 0) {
+                threads = std::stoul(option.substr(9));
+            }
+            else if (option.rfind("-max-instructions=", 0) == 0) {
+                max_instructions = std::stoull(option.substr(18));
+            }
+            else if (option.rfind("-timeout-ms=", 0) == 0) {
+                timeout_ms = std::stod(option.substr(12));
+            }
+            else if (option == "-guests") {
+                guests = true;
+            }
+            else {
+                throw std::runtime_error("Invalid batch option provided. Available options are: -threads=<n>, "
+                                         "-max-instructions=<n>, -timeout-ms=<n>, -guests");
+            }
+        }
+        if (guests) {
+            return run_guests(argv[2], threads, max_instructions, timeout_ms);
         }
-        else debug_mode = true;
+        return run_batch(argv[2], threads, max_instructions, timeout_ms);
     }
 
+    // run <image> [more images] [options], later images are loaded over earlier ones
+    std::vector<string> images{file_name};
+    string engine = "switch";
+    size_t flush_bytes = 64 << 10;
+    unsigned flush_ms = 50;
+    // only used if a -trap option changes something
+    LC3_Trap_Table traps = make_trap_table();
+    bool custom_traps = false;
+    bool profile = false;
+    string profile_path;  // report goes to stderr without one
+    string symbols_path;
+    string folded_path;   // call stacks for a flame graph, implies -profile
+    string record_path;
+    string replay_path;
+    // any of -headless, -input, -output, -max-instructions or -timeout-ms, see lc3_headless.h
+    bool headless = false;
+    string input_path;
+    string output_path;
+    headless_limits limits;
+
+    for (int i = 2; i < argc; i++) {
+        string mode_string = argv[i];
+
+        if (mode_string[0] != '-') {
+            images.push_back(mode_string);
+        }
+        else if (mode_string == "-debug") {
+            debug_mode = true;
+        }
+        else if (mode_string.rfind("-engine=", 0) == 0) {
+            engine = mode_string.substr(8);
+
+            if (engine != "switch" && engine != "threaded" && engine != "jit") {
+                throw std::runtime_error("Invalid engine provided. Available engines are: switch, threaded, jit");
+            }
+        }
+        else if (mode_string.rfind("-flush-bytes=", 0) == 0) {
+            flush_bytes = std::stoul(mode_string.substr(13));
+        }
+        else if (mode_string.rfind("-flush-ms=", 0) == 0) {
+            flush_ms = std::stoul(mode_string.substr(10));
+        }
+        else if (mode_string == "-headless") {
+            headless = true;
+        }
+        else if (mode_string.rfind("-input=", 0) == 0) {
+            input_path = mode_string.substr(7);
+            headless = true;
+        }
+        else if (mode_string.rfind("-output=", 0) == 0) {
+            output_path = mode_string.substr(8);
+            headless = true;
+        }
+        else if (mode_string.rfind("-max-instructions=", 0) == 0) {
+            limits.max_instructions = std::stoull(mode_string.substr(18));
+            headless = true;
+        }
+        else if (mode_string.rfind("-timeout-ms=", 0) == 0) {
+            limits.timeout_ms = std::stod(mode_string.substr(12));
+            headless = true;
+        }
+        else if (mode_string.rfind("-record=", 0) == 0) {
+            record_path = mode_string.substr(8);
+        }
+        else if (mode_string.rfind("-replay=", 0) == 0) {
+            replay_path = mode_string.substr(8);
+        }
+        else if (mode_string == "-profile") {
+            profile = true;
+        }
+        else if (mode_string.rfind("-profile=", 0) == 0) {
+            profile = true;
+            profile_path = mode_string.substr(9);
+        }
+        else if (mode_string.rfind("-folded=", 0) == 0) {
+            profile = true;
+            folded_path = mode_string.substr(8);
+        }
+        else if (mode_string.rfind("-symbols=", 0) == 0) {
+            symbols_path = mode_string.substr(9);
+        }
+        else if (mode_string == "-guest-traps") {
+            // keep whatever -trap options came before
+            LC3_Trap_Table fallback = make_trap_table(true);
+            for (int vector = 0; vector < 256; vector++) {
+                if (traps.entries[vector].kind == TH_NONE) {
+                    traps.entries[vector] = fallback.entries[vector];
+                }
+            }
+            custom_traps = true;
+        }
+        else if (mode_string.rfind("-trap=", 0) == 0) {
+            // -trap=x30:mul, vector in hex
+            size_t colon = mode_string.find(':');
+            if (mode_string[6] != 'x' || colon == string::npos) {
+                throw std::runtime_error("Invalid trap provided. Expected -trap=x<vector>:<mul|div|memcpy|guest>");
+            }
+            uint8_t vector = std::stoul(mode_string.substr(7, colon - 7), nullptr, 16);
+            string handler = mode_string.substr(colon + 1);
+
+            if (handler == "mul") set_trap(traps, vector, trap_multiply);
+            else if (handler == "div") set_trap(traps, vector, trap_divide);
+            else if (handler == "memcpy") set_trap(traps, vector, trap_memcpy);
+            else if (handler == "guest") set_guest_trap(traps, vector);
+            else throw std::runtime_error("Invalid trap handler provided. Available handlers are: mul, div, memcpy, guest");
+            custom_traps = true;
+        }
+        else {
+            throw std::runtime_error("Invalid mode provided. Available commands are: -debug, -engine=<switch|threaded|jit>, "
+                                     "-flush-bytes=<n>, -flush-ms=<n>, -guest-traps, -trap=x<vector>:<handler>, -profile[=<report>], -folded=<file>, -symbols=<file>, "
+                                     "-record=<log>, -replay=<log>, -headless, -input=<file|->, -output=<file>, "
+                                     "-max-instructions=<n>, -timeout-ms=<n>");
+        }
+    }
+
+    output_configure(flush_bytes, flush_ms);
+
     if (debug_mode) {
-        machine = new LC3_Debugger;
+        machine = new LC3_Debugger();
     }
     else {
-        machine = new LC3_Machine;
+        machine = new LC3_Machine();
+    }
+
+    for (const string &warning : load_images(images, machine).warnings) {
+        std::cerr << "warning: " << warning << std::endl;
+    }
+
+    init_registers(machine);
+
+    if (custom_traps) {
+        machine->traps = &traps;
     }
 
-    std::ifstream ifs{file_name, std::ios::binary};
+    // counts come from the switch interpreter, so -profile runs on that whatever -engine says
+    run_profile counts;
+    if (profile) {
+        machine->profile = &counts;
+    }
 
-    read_image(ifs, machine);
+    if (!debug_mode && engine == "jit" && !jit_attach(machine)) {
+        throw std::runtime_error("The JIT isn't supported on this platform");
+    }
+    bool threaded = engine == "threaded" && !profile;
 
-    // since exactly one condition flag should be set at any given time, set the Z flag
-    (*machine).reg[R_COND] = FL_ZRO;
+    // hot addresses and blocks are read against the code the program ended with
+    auto write_reports = [&] {
+        if (!profile) {
+            return;
+        }
+        output_flush();
+        symbol_table symbols = symbols_path.empty() ? symbol_table() : load_symbols(symbols_path);
+
+        if (!folded_path.empty()) {
+            std::ofstream folded(folded_path);
+            if (!folded) {
+                throw std::runtime_error("Couldn't write call stacks " + folded_path);
+            }
+            write_folded(folded, counts, symbols);
+        }
+        else if (profile_path.empty()) {
+            write_profile(std::cerr, counts, machine, symbols);
+        }
 
-    // set the PC to starting position 
-    enum { PC_START = 0x3000 };
-    enum { STACK_START = 0xFD00};
-    machine->reg[R_R6] = STACK_START;
-    machine->reg[R_PC] = PC_START;
+        if (!profile_path.empty()) {
+            std::ofstream report(profile_path);
+            if (!report) {
+                throw std::runtime_error("Couldn't write profile " + profile_path);
+            }
+            write_profile(report, counts, machine, symbols);
+        }
+    };
+
+    // input from a file (or all of stdin), output kept byte for byte, terminal left alone. Exits 0 if
+    // the program halted
+    if (headless) {
+        if (debug_mode) {
+            throw std::runtime_error("-debug needs the terminal, it can't run headless");
+        }
+
+        std::ostringstream input;
+        if (input_path == "-") {
+            input << std::cin.rdbuf();
+        }
+        else if (!input_path.empty()) {
+            std::ifstream ifs{input_path, std::ios::binary};
+            if (!ifs) {
+                throw std::runtime_error("Couldn't open input " + input_path);
+            }
+            input << ifs.rdbuf();
+        }
+
+        Buffer_IO io{input.str()};
+        // the log is of what the guest asked the Buffer_IO, same as Record_IO over the terminal
+        std::unique_ptr<Record_IO> record;
+        LC3_IO *guest_io = &io;
+        if (!record_path.empty() || !replay_path.empty()) {
+            record = std::make_unique<Record_IO>(&io);
+            guest_io = record.get();
+        }
+        if (!replay_path.empty()) {
+            record->log = load_log(replay_path);
+        }
+
+        headless_result result = run_headless(machine, *guest_io, limits, !threaded, profile ? RUN_PROFILE : 0);
+
+        if (!record_path.empty()) {
+            save_log(record_path, record->log);
+        }
+        write_reports();
+        delete machine;
+
+        if (output_path.empty()) {
+            std::cout.write(io.output.data(), io.output.size());
+            std::cout.flush();
+        }
+        else {
+            std::ofstream ofs{output_path, std::ios::binary};
+            ofs.write(io.output.data(), io.output.size());
+            if (!ofs) {
+                throw std::runtime_error("Couldn't write output " + output_path);
+            }
+        }
+
+        if (result.timed_out) {
+            std::cerr << "timed out after " << result.ms << " ms";
+        }
+        else if (result.reason == EXIT_BUDGET) {
+            std::cerr << "still running after " << result.executed << " instructions";
+        }
+        else if (result.reason == EXIT_ILLEGAL_OPCODE) {
+            std::cerr << "illegal opcode";
+        }
+        else {
+            return 0;
+        }
+        std::cerr << ", at x" << std::hex << result.pc << std::endl;
+        return 1;
+    }
 
     int running = 1;
 
@@ -101,12 +333,34 @@ int main(int argc, char *argv[]) {
         debugger->running = true;
     }
 
+    // the debugger always records so it can go backwards, otherwise only when asked to (lc3_replay.h)
+    std::unique_ptr<LC3_Recorder> recorder;
+    std::unique_ptr<Record_IO> plain_record;
+    Record_IO *record = nullptr;
+
+    if (debug_mode) {
+        recorder = std::make_unique<LC3_Recorder>(machine);
+        debugger->recorder = recorder.get();
+        record = &recorder->io();
+    }
+    else if (!record_path.empty() || !replay_path.empty()) {
+        plain_record = std::make_unique<Record_IO>(machine->io);
+        machine->io = plain_record.get();
+        record = plain_record.get();
+    }
+    if (!replay_path.empty()) {
+        record->log = load_log(replay_path);
+    }
+
     signal(SIGINT, handle_interrupt);
     disable_input_buffering();
 
     while (running) {
-        if (!debug_mode) {
-            running = run_loop(machine);
+        if (!debug_mode && threaded) {
+            running = run_threaded(machine);
+        }
+        else if (!debug_mode) {
+            running = run_switch(machine, profile ? RUN_PROFILE : 0);
         }
         else {
             // casting pointer here isn't great
@@ -117,8 +371,16 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    delete machine;
+    if (!record_path.empty()) {
+        save_log(record_path, record->log);
+    }
+
+    jit_detach(machine);
+    recorder.reset();
     restore_input_buffering();
+
+    write_reports();
+    delete machine;
 }
 
 